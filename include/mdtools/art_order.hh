@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_ART_ORDER_HH
+#define LIB_ART_ORDER_HH
+
+#include <mdtools/mappingfile.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct art_order {
+    // DPLC entries that split needs for mappings, in total and for the frame
+    // that needs the most.
+    struct entry_count {
+        size_t total = 0;
+        size_t worst = 0;
+    };
+    // Tile of the input art that goes to each position of the new art.
+    std::vector<size_t> tiles;
+    entry_count         before;
+    entry_count         after;
+
+    art_order() = default;
+    // Finds an order for the art_size tiles of the art that needs as few DPLC
+    // entries as it can, first in total, then in the worst frame. The maps
+    // must refer to the art directly, as merge leaves them. The tiles of each
+    // piece stay together, in order. Several searches are run, on up to
+    // num_threads threads (0 means one per core); the result does not depend
+    // on how many threads are used.
+    art_order(mapping_file const& maps, size_t art_size, unsigned num_threads);
+
+    // Rewrites the maps, or the art, for the new order.
+    void apply(mapping_file& maps) const;
+    [[nodiscard]] std::vector<uint8_t> apply(
+            std::span<uint8_t const> art) const;
+};
+
+#endif    // LIB_ART_ORDER_HH
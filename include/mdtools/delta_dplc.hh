@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_DELTA_DPLC_HH
+#define LIB_DELTA_DPLC_HH
+
+#include <mdtools/dplcfile.hh>
+#include <mdtools/mappingfile.hh>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Mappings and DPLC for animation sequences that do not reload the tiles
+// they share. DPLC entries are always loaded one after the other from the
+// start of the VRAM of the object, so each frame can only replace a prefix
+// of it. Tiles that several frames of a sequence use go into a stable area
+// past the tiles of every frame, which only the first frame of the sequence
+// loads; the other frames only load their own tiles.
+struct delta_dplc {
+    mapping_file maps;
+    dplc_file    dplc;
+    // The sequences, with the frames of maps and dplc to use for them.
+    std::vector<std::vector<size_t>> sequences;
+    // Tiles loaded by going once through every sequence, with plain and with
+    // delta DPLC, and the most VRAM tiles any sequence needs.
+    size_t tiles_before = 0;
+    size_t tiles_after  = 0;
+    size_t vram_tiles   = 0;
+    // Sequences with a frame that needs more tiles than vram_budget on its
+    // own, with the tiles of that frame. They get plain DPLCs, so vram_tiles
+    // is over the budget if this is not empty.
+    std::vector<std::pair<size_t, size_t>> over_budget;
+
+    // The source mappings must refer to the art directly, as merge leaves
+    // them, and the sequences are lists of their frames. The first frames of
+    // maps and dplc are those of source, split as usual; the frames for the
+    // sequences come after them. Each sequence may use up to vram_budget
+    // tiles of VRAM, or as many as its largest frame if 0.
+    delta_dplc(
+            mapping_file const&                     source,
+            std::vector<std::vector<size_t>> const& sequences_,
+            size_t                                  vram_budget);
+};
+
+#endif    // LIB_DELTA_DPLC_HH
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DMA_TIMING_HH
+#define DMA_TIMING_HH
+
+#include <cstddef>
+
+// Rough model of how long the VDP takes to DMA data from 68k memory to VRAM,
+// for a 224-line display.
+struct dma_timing {
+    // Bytes moved per line, in active display and in blanking.
+    size_t display_rate;
+    size_t blank_rate;
+    // Lines of vertical blanking in a frame, and how long a line takes.
+    size_t vblank_lines;
+    double line_us;
+
+    constexpr dma_timing(bool const h32, bool const pal) noexcept
+            : display_rate(h32 ? 16 : 18), blank_rate(h32 ? 167 : 205),
+              vblank_lines(pal ? 313 - 224 : 262 - 224),
+              line_us(pal ? 64.0 : 63.5) {}
+
+    // Bytes that can be moved during a whole vertical blank.
+    [[nodiscard]] constexpr size_t vblank_bytes() const noexcept {
+        return vblank_lines * blank_rate;
+    }
+    // Lines needed to move the bytes in active display or in blanking.
+    [[nodiscard]] constexpr size_t display_lines(
+            size_t const bytes) const noexcept {
+        return (bytes + display_rate - 1) / display_rate;
+    }
+    [[nodiscard]] constexpr size_t blank_lines(
+            size_t const bytes) const noexcept {
+        return (bytes + blank_rate - 1) / blank_rate;
+    }
+    [[nodiscard]] constexpr double to_us(size_t const lines) const noexcept {
+        return double(lines) * line_us;
+    }
+};
+
+#endif    // DMA_TIMING_HH
@@ -30,7 +30,11 @@ struct dplc_file {
 
     dplc_file() = default;
     dplc_file(std::istream& input, int version);
-    void write(std::ostream& output, int version, bool null_first) const;
+    // With share_tails, frames found inside other frames are stored there.
+    // Returns how many bytes this saved.
+    size_t write(
+            std::ostream& output, int version, bool null_first,
+            bool share_tails = false) const;
     void print() const;
 
     [[nodiscard]] dplc_file consolidate() const;
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DEDUP_HH
+#define FRAME_DEDUP_HH
+
+#include <mdcomp/bigendian_io.hh>
+#include <mdtools/span_stream.hh>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <ostream>
+#include <span>
+#include <vector>
+
+// Mixes word into a running 64-bit hash.
+constexpr inline uint64_t hash_combine(
+        uint64_t hash, uint64_t const word) noexcept {
+    hash ^= word * 0xff51afd7ed558ccdULL;
+    hash = ((hash << 31U) | (hash >> 33U)) * 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 29U);
+}
+
+// Returns, for each frame, the index of the first frame equal to it, which is
+// its own index if it is the first. Frames are found by their hash() in an
+// open addressing table of frame indices, and only compared in full if their
+// hashes match.
+template <typename Frame>
+std::vector<uint32_t> find_first_copies(std::vector<Frame> const& frames) {
+    constexpr static uint32_t const empty = ~0U;
+
+    size_t const          capacity = std::bit_ceil(2 * frames.size() + 1);
+    size_t const          mask     = capacity - 1;
+    std::vector<uint32_t> slots(capacity, empty);
+    std::vector<uint64_t> hashes(frames.size());
+    std::vector<uint32_t> first(frames.size());
+    for (size_t ii = 0; ii < frames.size(); ii++) {
+        uint64_t const hash = frames[ii].hash();
+        hashes[ii]          = hash;
+        for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            uint32_t const index = slots[slot];
+            if (index == empty) {
+                slots[slot] = first[ii] = static_cast<uint32_t>(ii);
+                break;
+            }
+            if (hashes[index] == hash && frames[index] == frames[ii]) {
+                first[ii] = index;
+                break;
+            }
+        }
+    }
+    return first;
+}
+
+// Builds the suffix array of text by prefix doubling: the starting positions
+// of all suffixes of text, in lexicographic order.
+inline std::vector<uint32_t> build_suffix_array(
+        std::vector<int32_t> const& text) {
+    size_t const          length = text.size();
+    std::vector<uint32_t> suffixes(length);
+    std::vector<int64_t>  rank(text.begin(), text.end());
+    std::vector<int64_t>  next(length);
+    std::iota(suffixes.begin(), suffixes.end(), 0U);
+    for (size_t width = 1;; width *= 2) {
+        auto const key = [&](uint32_t const position) {
+            return std::pair(
+                    rank[position], position + width < length
+                                            ? rank[position + width]
+                                            : INT64_MIN);
+        };
+        std::sort(
+                suffixes.begin(), suffixes.end(),
+                [&](uint32_t const left, uint32_t const right) {
+                    return key(left) < key(right);
+                });
+        next[suffixes.front()] = 0;
+        for (size_t ii = 1; ii < length; ii++) {
+            next[suffixes[ii]] = next[suffixes[ii - 1]]
+                                 + (key(suffixes[ii - 1]) < key(suffixes[ii])
+                                            ? 1
+                                            : 0);
+        }
+        rank.swap(next);
+        if (rank[suffixes.back()] == static_cast<int64_t>(length - 1)) {
+            return suffixes;
+        }
+    }
+}
+
+// Writes an offset table followed by the data of frames. Copies of a frame
+// share its offset, and if null_frame is set, the first frame gets offset 0
+// and is not written. With share_tails, a frame whose data is found inside
+// that of a larger frame is not written either, and points into the larger
+// one instead; this respects the word alignment of all versions but Sonic 1.
+// Returns how many bytes this saved.
+template <typename Frame>
+size_t write_frames(
+        std::ostream& output, std::vector<Frame> const& frames,
+        int const version, bool const null_frame, bool const share_tails) {
+    std::vector<uint32_t> const first = find_first_copies(frames);
+
+    // The frames that must be stored, and their data.
+    std::vector<uint32_t>             unique;
+    std::vector<std::vector<uint8_t>> data(frames.size());
+    for (size_t ii = 0; ii < frames.size(); ii++) {
+        if (first[ii] == ii && !(ii == 0 && null_frame)) {
+            unique.push_back(static_cast<uint32_t>(ii));
+            data[ii].resize(frames[ii].size(version));
+            SpanOutputStream stream(data[ii]);
+            frames[ii].write(stream, version);
+        }
+    }
+
+    // Each frame is stored in a host frame, at an offset within it; hosts
+    // are stored in full.
+    std::vector<uint32_t> host(frames.size());
+    std::vector<size_t>   inside(frames.size());
+    for (auto const index : unique) {
+        host[index] = index;
+    }
+    size_t saved = 0;
+    if (share_tails && unique.size() > 1) {
+        // Larger frames go first, so that they are placed before any frame
+        // they could contain. The text has all their data, each followed by
+        // a unique negative separator, so that matches never cross frames.
+        std::vector<uint32_t> order(unique);
+        std::stable_sort(
+                order.begin(), order.end(),
+                [&](uint32_t const left, uint32_t const right) {
+                    return data[left].size() > data[right].size();
+                });
+        std::vector<int32_t>  text;
+        std::vector<uint32_t> starts;
+        for (auto const index : order) {
+            starts.push_back(static_cast<uint32_t>(text.size()));
+            text.insert(text.end(), data[index].begin(), data[index].end());
+            text.push_back(-static_cast<int32_t>(starts.size()));
+        }
+        std::vector<uint32_t> const suffixes = build_suffix_array(text);
+
+        size_t const align = version == 1 ? 1 : 2;
+        for (size_t ii = 1; ii < order.size(); ii++) {
+            std::vector<uint8_t> const& pattern = data[order[ii]];
+            // Suffixes starting with the pattern form a contiguous range.
+            auto const compare = [&](uint32_t const position, bool const less) {
+                for (size_t jj = 0; jj < pattern.size(); jj++) {
+                    if (position + jj >= text.size()
+                        || text[position + jj] != pattern[jj]) {
+                        bool const below = position + jj >= text.size()
+                                           || text[position + jj] < pattern[jj];
+                        return less ? below : !below;
+                    }
+                }
+                return false;
+            };
+            auto const begin = std::partition_point(
+                    suffixes.begin(), suffixes.end(),
+                    [&](uint32_t const position) {
+                        return compare(position, true);
+                    });
+            auto const end = std::partition_point(
+                    begin, suffixes.end(), [&](uint32_t const position) {
+                        return !compare(position, false);
+                    });
+            for (auto it = begin; it != end; ++it) {
+                // Only frames placed earlier can contain this one.
+                size_t const owner = static_cast<size_t>(
+                        std::upper_bound(starts.begin(), starts.end(), *it)
+                        - starts.begin() - 1);
+                uint32_t const index = order[owner];
+                size_t const   where = inside[index] + *it - starts[owner];
+                if (owner < ii && where % align == 0) {
+                    host[order[ii]]   = host[index];
+                    inside[order[ii]] = where;
+                    saved += pattern.size();
+                    break;
+                }
+            }
+        }
+    }
+
+    // Hosts are stored in the order they first appear.
+    std::vector<size_t> offsets(frames.size());
+    size_t              size = 2 * frames.size();
+    for (auto const index : unique) {
+        if (host[index] == index) {
+            offsets[index] = size;
+            size += data[index].size();
+        }
+    }
+    std::vector<uint8_t> buffer(size);
+    SpanOutputStream     stream(buffer);
+    for (size_t ii = 0; ii < frames.size(); ii++) {
+        uint32_t const index = first[ii];
+        if (!(index == 0 && null_frame)) {
+            offsets[ii] = offsets[host[index]] + inside[index];
+        }
+        BigEndian::Write2(stream, offsets[ii]);
+    }
+    for (auto const index : unique) {
+        if (host[index] == index) {
+            stream.write(
+                    static_cast<char const*>(
+                            static_cast<void const*>(data[index].data())),
+                    static_cast<std::streamsize>(data[index].size()));
+        }
+    }
+    output.write(
+            static_cast<char const*>(static_cast<void const*>(buffer.data())),
+            static_cast<std::streamsize>(buffer.size()));
+    return saved;
+}
+
+#endif    // FRAME_DEDUP_HH
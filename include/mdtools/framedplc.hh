@@ -21,6 +21,7 @@
 #include <mdtools/singledplc.hh>
 
 #include <compare>
+#include <cstdint>
 #include <iosfwd>
 #include <map>
 #include <vector>
@@ -36,6 +37,8 @@ struct frame_dplc {
     frame_dplc(std::istream& input, int version);
     void write(std::ostream& output, int version) const;
     void print() const;
+    // Hash of all the pieces, for finding duplicate frames.
+    [[nodiscard, gnu::pure]] uint64_t hash() const noexcept;
 
     [[nodiscard]] std::map<size_t, size_t> build_vram_map() const;
 
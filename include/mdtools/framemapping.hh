@@ -22,6 +22,7 @@
 #include <mdtools/singlemapping.hh>
 
 #include <compare>
+#include <cstdint>
 #include <iosfwd>
 #include <vector>
 
@@ -37,6 +38,8 @@ struct frame_mapping {
     frame_mapping(std::istream& input, int version);
     void write(std::ostream& output, int version) const;
     void print() const;
+    // Hash of all the pieces, for finding duplicate frames.
+    [[nodiscard, gnu::pure]] uint64_t hash() const noexcept;
     void change_pal(int source_palette, int dest_palette);
 
     [[nodiscard]] frame_mapping merge(frame_dplc const& dplc) const;
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPED_FILE_HH
+#define MAPPED_FILE_HH
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+// Read-only view of the contents of a whole file, mapped into memory. Check
+// good() before using the contents.
+class MappedFile {
+    boost::interprocess::file_mapping  mapping;
+    boost::interprocess::mapped_region region;
+    bool                               valid = false;
+
+public:
+    explicit MappedFile(std::filesystem::path const& name) noexcept {
+        std::error_code error;
+        auto const      size = std::filesystem::file_size(name, error);
+        if (error) {
+            return;
+        }
+        // Empty files cannot be mapped, but they are valid.
+        if (size != 0) {
+            try {
+                mapping = boost::interprocess::file_mapping(
+                        name.c_str(), boost::interprocess::read_only);
+                region = boost::interprocess::mapped_region(
+                        mapping, boost::interprocess::read_only);
+            } catch (boost::interprocess::interprocess_exception const&) {
+                return;
+            }
+        }
+        valid = true;
+    }
+
+    [[nodiscard]] bool good() const noexcept {
+        return valid;
+    }
+    [[nodiscard]] std::span<uint8_t const> bytes() const noexcept {
+        return {static_cast<uint8_t const*>(region.get_address()),
+                region.get_size()};
+    }
+};
+
+#endif    // MAPPED_FILE_HH
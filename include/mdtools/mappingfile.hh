@@ -31,7 +31,11 @@ struct mapping_file {
 
     mapping_file() = default;
     mapping_file(std::istream& input, int version);
-    void write(std::ostream& output, int version, bool null_first) const;
+    // With share_tails, frames found inside other frames are stored there.
+    // Returns how many bytes this saved.
+    size_t write(
+            std::ostream& output, int version, bool null_first,
+            bool share_tails = false) const;
     void print() const;
     void merge(mapping_file const& source, dplc_file const& dplc);
     void change_pal(int source_palette, int dest_palette);
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKED_TILE_HH
+#define PACKED_TILE_HH
+
+#include <mdtools/pattern_name.hh>
+#include <mdtools/tile.hh>
+#include <mdtools/tile_distance.hh>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+// SWAR helpers for lines of 8 pixels packed into 32 bits as in VRAM: 4 bits
+// per pixel, leftmost pixel in the highest nibble.
+
+// Reverses the order of the bytes of a word.
+constexpr inline uint32_t swap_bytes(uint32_t const value) noexcept {
+    return ((value & 0x000000ffU) << 24U) | ((value & 0x0000ff00U) << 8U)
+           | ((value & 0x00ff0000U) >> 8U) | ((value & 0xff000000U) >> 24U);
+}
+constexpr inline uint64_t swap_bytes(uint64_t const value) noexcept {
+    return (static_cast<uint64_t>(swap_bytes(static_cast<uint32_t>(value)))
+            << 32U)
+           | swap_bytes(static_cast<uint32_t>(value >> 32U));
+}
+
+// Mirrors a line horizontally.
+constexpr inline uint32_t reverse_nibbles(uint32_t const line) noexcept {
+    return swap_bytes(
+            ((line >> 4U) & 0x0f0f0f0fU) | ((line & 0x0f0f0f0fU) << 4U));
+}
+
+// Moves each pixel of the line to its own byte, leftmost pixel in the highest
+// byte.
+constexpr inline uint64_t spread_nibbles(uint32_t const line) noexcept {
+    uint64_t value = line;
+    value = ((value & 0x00000000ffff0000ULL) << 16U)
+            | (value & 0x000000000000ffffULL);
+    value = ((value & 0x0000ff000000ff00ULL) << 8U)
+            | (value & 0x000000ff000000ffULL);
+    value = ((value & 0x00f000f000f000f0ULL) << 4U)
+            | (value & 0x000f000f000f000fULL);
+    return value;
+}
+
+// Inverse of spread_nibbles; only the low nibble of each byte is used.
+constexpr inline uint32_t gather_nibbles(uint64_t value) noexcept {
+    value &= 0x0f0f0f0f0f0f0f0fULL;
+    value = ((value >> 4U) & 0x00f000f000f000f0ULL)
+            | (value & 0x000f000f000f000fULL);
+    value = ((value >> 8U) & 0x0000ff000000ff00ULL)
+            | (value & 0x000000ff000000ffULL);
+    value = ((value >> 16U) & 0x00000000ffff0000ULL)
+            | (value & 0x000000000000ffffULL);
+    return static_cast<uint32_t>(value);
+}
+
+// Reads/writes a big-endian value from/to memory.
+template <typename T>
+inline T load_big_endian(uint8_t const* bytes) noexcept {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    if constexpr (std::endian::native == std::endian::little) {
+        value = swap_bytes(value);
+    }
+    return value;
+}
+template <typename T>
+inline void store_big_endian(uint8_t* bytes, T value) noexcept {
+    if constexpr (std::endian::native == std::endian::little) {
+        value = swap_bytes(value);
+    }
+    std::memcpy(bytes, &value, sizeof(T));
+}
+
+// Replaces every pixel in the buffer by its entry in the colors table.
+inline void remap_nibbles_scalar(
+        uint8_t* bytes, size_t count,
+        std::array<uint8_t, 16> const& colors) noexcept {
+    std::array<uint8_t, 256> table;
+    for (size_t ii = 0; ii < table.size(); ii++) {
+        table[ii] = static_cast<uint8_t>(
+                ((colors[ii >> 4U] & 0xfU) << 4U) | (colors[ii & 0xfU] & 0xfU));
+    }
+    for (size_t ii = 0; ii < count; ii++) {
+        bytes[ii] = table[bytes[ii]];
+    }
+}
+
+#ifdef TILE_DISTANCE_X86
+// As above, doing 32 pixels at a time with byte shuffles.
+__attribute__((target("sse4.1"))) inline void remap_nibbles_sse41(
+        uint8_t* bytes, size_t count,
+        std::array<uint8_t, 16> const& colors) noexcept {
+    __m128i const nibble = _mm_set1_epi8(0x0f);
+    __m128i const table  = _mm_and_si128(
+            _mm_loadu_si128(static_cast<__m128i const*>(
+                    static_cast<void const*>(colors.data()))),
+            nibble);
+    size_t ii = 0;
+    for (; ii + 16 <= count; ii += 16) {
+        auto* const where
+                = static_cast<__m128i*>(static_cast<void*>(bytes + ii));
+        __m128i const value = _mm_loadu_si128(where);
+        __m128i const low
+                = _mm_shuffle_epi8(table, _mm_and_si128(value, nibble));
+        __m128i const high  = _mm_shuffle_epi8(
+                table, _mm_and_si128(_mm_srli_epi16(value, 4), nibble));
+        _mm_storeu_si128(where, _mm_or_si128(low, _mm_slli_epi16(high, 4)));
+    }
+    remap_nibbles_scalar(bytes + ii, count - ii, colors);
+}
+#endif
+
+// Tile class template that keeps the pixels packed as the VDP does, at half the
+// size of BaseTile. Each line is kept in a 32-bit word, so lines must have 8
+// pixels. Flips, comparisons, hashing and color changes work directly on the
+// packed lines; conversions to and from BaseTile are provided for everything
+// else.
+template <int lsize, int nlines>
+class BasePackedTile {
+    static_assert(lsize == 8, "Packed tiles must have lines of 8 pixels!");
+
+public:
+    // Exported constants.
+    static constexpr size_t const Line_size = lsize;
+    static constexpr size_t const Num_lines = nlines;
+    static constexpr size_t const Tile_size = nlines * lsize;
+    static constexpr size_t const Byte_size = nlines * lsize / 2;
+    // Exported types.
+    using Unpacked = BaseTile<lsize, nlines>;
+
+private:
+    std::array<uint32_t, nlines> lines{};
+
+public:
+    // Constructors.
+    BasePackedTile() noexcept = default;
+    // From Byte_size bytes in VRAM format.
+    explicit BasePackedTile(uint8_t const* bytes) noexcept {
+        for (auto& line : lines) {
+            line = load_big_endian<uint32_t>(bytes);
+            bytes += sizeof(uint32_t);
+        }
+    }
+    // From stream. If the stream ends early, the rest is filled with zeroes.
+    explicit BasePackedTile(std::istream& input) noexcept {
+        std::array<char, Byte_size> buffer{};
+        input.read(buffer.data(), buffer.size());
+        *this = BasePackedTile(static_cast<uint8_t const*>(
+                static_cast<void const*>(buffer.data())));
+    }
+    // From an unpacked tile.
+    explicit BasePackedTile(Unpacked const& tile) noexcept {
+        uint8_t const* pixels = tile.data();
+        for (auto& line : lines) {
+            line = gather_nibbles(load_big_endian<uint64_t>(pixels));
+            pixels += Line_size;
+        }
+    }
+
+    // Converts to an unpacked tile.
+    [[nodiscard]] Unpacked unpack() const noexcept {
+        Unpacked tile;
+        uint8_t* pixels = tile.data();
+        for (auto const line : lines) {
+            store_big_endian(pixels, spread_nibbles(line));
+            pixels += Line_size;
+        }
+        return tile;
+    }
+
+    // Writes Byte_size bytes in VRAM format.
+    void write(uint8_t* bytes) const noexcept {
+        for (auto const line : lines) {
+            store_big_endian(bytes, line);
+            bytes += sizeof(uint32_t);
+        }
+    }
+    void write(std::ostream& output) const noexcept {
+        std::array<uint8_t, Byte_size> buffer;
+        write(buffer.data());
+        output.write(
+                static_cast<char const*>(
+                        static_cast<void const*>(buffer.data())),
+                buffer.size());
+    }
+
+    // Line access, leftmost pixel in the highest nibble.
+    [[nodiscard]] uint32_t get_line(size_t const index) const noexcept {
+        return lines[index];
+    }
+    void set_line(size_t const index, uint32_t const line) noexcept {
+        lines[index] = line;
+    }
+    [[nodiscard]] uint8_t get_pixel(
+            size_t const xpos, size_t const ypos) const noexcept {
+        return static_cast<uint8_t>(
+                (lines[ypos] >> (4U * (Line_size - 1 - xpos))) & 0xfU);
+    }
+
+    // Returns the tile as seen with the given flip mode.
+    [[nodiscard]] BasePackedTile flipped(FlipMode const flip) const noexcept {
+        BasePackedTile output(*this);
+        if ((flip & XFlip) != 0) {
+            for (auto& line : output.lines) {
+                line = reverse_nibbles(line);
+            }
+        }
+        if ((flip & YFlip) != 0) {
+            std::reverse(output.lines.begin(), output.lines.end());
+        }
+        return output;
+    }
+
+    // Hash of the packed pixels.
+    [[nodiscard]] uint64_t hash() const noexcept {
+        return hash_pixels(
+                static_cast<uint8_t const*>(
+                        static_cast<void const*>(lines.data())),
+                sizeof(lines));
+    }
+    // Hash that is the same for the tile and all its flipped versions.
+    [[nodiscard]] uint64_t canonical_hash() const noexcept {
+        return std::min(
+                {hash(), flipped(XFlip).hash(), flipped(YFlip).hash(),
+                 flipped(XYFlip).hash()});
+    }
+    // Finds the flip mode that turns this tile into the other, if any. The
+    // modes are tried in the same order as VRAM::find_closest.
+    [[nodiscard]] bool matches(
+            BasePackedTile const& other, FlipMode& flip) const noexcept {
+        static constexpr std::array<FlipMode, 4> const modes{
+                NoFlip, XFlip, YFlip, XYFlip};
+        for (auto const mode : modes) {
+            if (flipped(mode) == other) {
+                flip = mode;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Replaces every pixel by its entry in the colors table.
+    void remap(std::array<uint8_t, 16> const& colors) noexcept {
+        auto* const bytes
+                = static_cast<uint8_t*>(static_cast<void*>(lines.data()));
+#ifdef TILE_DISTANCE_X86
+        if (best_distance_kernel() != DistanceKernel::Scalar) {
+            remap_nibbles_sse41(bytes, sizeof(lines), colors);
+            return;
+        }
+#endif
+        remap_nibbles_scalar(bytes, sizeof(lines), colors);
+    }
+
+    [[nodiscard]] bool operator==(
+            BasePackedTile const& right) const noexcept = default;
+};
+
+using PackedTile = BasePackedTile<8, 8>;
+
+#endif    // PACKED_TILE_HH
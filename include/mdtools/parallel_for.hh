@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_FOR_HH
+#define PARALLEL_FOR_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Number of threads to use when the caller asks for 0.
+inline unsigned default_thread_count() noexcept {
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Calls func(ii) for every ii in [0, count), spread across up to num_threads
+// threads (0 means one per core). Items are handed out in order, one at a time,
+// so uneven work is balanced. Returns once all calls are done. If a call
+// throws, no more items are handed out, and the first exception is rethrown
+// once all threads have finished.
+template <typename Func>
+void parallel_for(size_t const count, unsigned num_threads, Func const& func) {
+    if (num_threads == 0) {
+        num_threads = default_thread_count();
+    }
+    num_threads = static_cast<unsigned>(
+            std::min<size_t>(num_threads, count));
+    if (num_threads <= 1) {
+        for (size_t ii = 0; ii < count; ii++) {
+            func(ii);
+        }
+        return;
+    }
+    std::atomic<size_t>             next{0};
+    std::vector<std::exception_ptr> errors(num_threads);
+
+    auto const worker = [&](unsigned const index) noexcept {
+        try {
+            for (size_t ii = next++; ii < count; ii = next++) {
+                func(ii);
+            }
+        } catch (...) {
+            errors[index] = std::current_exception();
+            next          = count;
+        }
+    };
+    {
+        // The threads are joined when leaving this scope, even if starting
+        // one of them fails.
+        std::vector<std::jthread> threads;
+        threads.reserve(num_threads - 1);
+        for (unsigned ii = 1; ii < num_threads; ii++) {
+            threads.emplace_back(worker, ii);
+        }
+        worker(0);
+    }
+    for (auto const& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+#endif    // PARALLEL_FOR_HH
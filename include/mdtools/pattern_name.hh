@@ -87,6 +87,9 @@ class Pattern_Name {
     ~Pattern_Name() noexcept                         = default;
 
     // Getters.
+    [[nodiscard]] constexpr uint16_t get_value() const noexcept {
+        return pattern_name;
+    }
     [[nodiscard]] constexpr uint16_t get_tile() const noexcept {
         return (pattern_name & tile_mask);
     }
@@ -18,12 +18,18 @@
 #ifndef PATTERN_NAME_TABLE_HH
 #define PATTERN_NAME_TABLE_HH
 
-#include <mdcomp/bigendian_io.hh>
 #include <mdcomp/enigma.hh>
 #include <mdtools/pattern_name.hh>
+#include <mdtools/span_stream.hh>
 
+#include <algorithm>
 #include <array>
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <vector>
 
 template <unsigned width, unsigned height>
 class Pattern_Name_Table {
@@ -34,6 +40,42 @@ class Pattern_Name_Table {
 private:
     std::array<Line, height> table;
 
+    // The bytes of the table, where words are read into in place.
+    std::span<uint8_t, sizeof(table)> bytes() noexcept {
+        static_assert(sizeof(table) == sizeof(Pattern_Name) * width * height);
+        return std::span<uint8_t, sizeof(table)>(
+                static_cast<uint8_t*>(static_cast<void*>(table.data())),
+                sizeof(table));
+    }
+    // Turns the first count bytes of the table, which hold big-endian words,
+    // into pattern names, and clears the rest of the table.
+    void from_big_endian(size_t const count) noexcept {
+        uint8_t const* const data  = bytes().data();
+        size_t const         words = count / 2;
+        size_t               index = 0;
+        for (Line& line : table) {
+            for (auto& pattern : line) {
+                if (index < words) {
+                    pattern = Pattern_Name(static_cast<uint16_t>(
+                            (data[index * 2] << 8U) | data[index * 2 + 1]));
+                } else {
+                    pattern = Pattern_Name();
+                }
+                index++;
+            }
+        }
+    }
+    // Converts the table to big-endian words, in sizeof(table) bytes.
+    void pack(uint8_t* bytes_out) const noexcept {
+        for (Line const& line : table) {
+            for (auto const& pattern : line) {
+                uint16_t const value = pattern.get_value();
+                *bytes_out++         = static_cast<uint8_t>(value >> 8U);
+                *bytes_out++         = static_cast<uint8_t>(value & 0xffU);
+            }
+        }
+    }
+
 protected:
     auto const& getTable() const noexcept {
         return table;
@@ -44,20 +86,31 @@ class Pattern_Name_Table {
 
 public:
     Pattern_Name_Table() noexcept = default;
+    // Both constructors decode or read the words straight into the table.
+    // Missing words are left blank.
     Pattern_Name_Table(std::istream& input, bool const compressed) noexcept {
-        std::stringstream inner_input(
-                std::ios::in | std::ios::out | std::ios::binary);
         if (compressed) {
-            enigma::decode(input, inner_input);
+            SpanOutputStream output(bytes());
+            enigma::decode(input, output);
+            from_big_endian(output.size());
         } else {
-            inner_input << input.rdbuf();
+            input.read(
+                    static_cast<char*>(static_cast<void*>(bytes().data())),
+                    sizeof(table));
+            from_big_endian(static_cast<size_t>(input.gcount()));
         }
-
-        for (Line& line : table) {
-            for (auto& pattern : line) {
-                uint16_t new_pattern = BigEndian::Read2(inner_input);
-                pattern = Pattern_Name(inner_input.good() ? new_pattern : 0U);
-            }
+    }
+    Pattern_Name_Table(
+            std::span<uint8_t const> input, bool const compressed) noexcept {
+        if (compressed) {
+            SpanInputStream  source(input);
+            SpanOutputStream output(bytes());
+            enigma::decode(source, output);
+            from_big_endian(output.size());
+        } else {
+            size_t const count = std::min(input.size(), sizeof(table));
+            std::copy_n(input.begin(), count, bytes().begin());
+            from_big_endian(count);
         }
     }
     Pattern_Name_Table(Pattern_Name_Table const&) noexcept            = default;
@@ -73,12 +126,21 @@ class Pattern_Name_Table {
         return table[index];
     }
 
+    // Converts the table to big-endian words, in a single buffer.
+    [[nodiscard]] std::vector<uint8_t> pack() const {
+        std::vector<uint8_t> buffer(sizeof(table));
+        pack(buffer.data());
+        return buffer;
+    }
+
+    // The words go through a buffer on the stack, as this must not throw.
     virtual void write(std::ostream& output) const noexcept {
-        for (Line const& line : table) {
-            for (auto const& pattern : line) {
-                pattern.write(output);
-            }
-        }
+        std::array<uint8_t, sizeof(table)> buffer;
+        pack(buffer.data());
+        output.write(
+                static_cast<char const*>(
+                        static_cast<void const*>(buffer.data())),
+                static_cast<std::streamsize>(buffer.size()));
     }
 };
 
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PATTERN_NAME_TRANSFORM_HH
+#define PATTERN_NAME_TRANSFORM_HH
+
+#include <mdtools/pattern_name.hh>
+#include <mdtools/tile_distance.hh>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// What happens when offsetting a tile index takes it out of [0, 0x7ff].
+enum class TileOverflow : uint8_t { Wrap, Clamp };
+
+// Rewrites pattern names in bulk. Each stage is set up by one of the chainable
+// setters below, with later calls replacing earlier ones, and all stages are
+// done in a single pass, in this order: tile offset, palette remap, flip toggle
+// and priority. Pattern names whose tile is filtered out are left untouched.
+class Pattern_Name_Transform {
+    enum : uint32_t {
+        tile_mask     = 0x07ffU,
+        tile_count    = tile_mask + 1,
+        flip_shift    = 11,
+        palette_shift = 13,
+        palette_mask  = 3U << palette_shift,
+        priority_mask = 0x8000U,
+        flags_mask    = 0xffffU & ~(tile_mask | palette_mask)
+    };
+
+    // Tiles to transform, and the blacklisted tiles, which never are.
+    std::bitset<tile_count> selected;
+    std::bitset<tile_count> blacklisted;
+    std::array<uint8_t, 4>  palettes{0, 1, 2, 3};
+    int32_t                 delta     = 0;
+    TileOverflow            overflow  = TileOverflow::Wrap;
+    bool                    filtered     = false;
+    bool                    whitelisting = false;
+    uint16_t                keep_mask    = flags_mask;
+    uint16_t                flip_bits    = 0;
+    uint16_t                set_bits     = 0;
+
+    [[nodiscard]] uint32_t offset_tile(uint32_t const tile) const noexcept {
+        int32_t const value = static_cast<int32_t>(tile) + delta;
+        if (overflow == TileOverflow::Clamp) {
+            return static_cast<uint32_t>(
+                    std::clamp(value, 0, static_cast<int32_t>(tile_mask)));
+        }
+        return static_cast<uint32_t>(value) & tile_mask;
+    }
+
+    void apply_scalar(uint16_t* words, size_t const count) const noexcept {
+        for (size_t ii = 0; ii < count; ii++) {
+            words[ii] = (*this)(Pattern_Name(words[ii])).get_value();
+        }
+    }
+
+#ifdef TILE_DISTANCE_X86
+    // As above, doing 8 pattern names at a time.
+    __attribute__((target("sse4.1"))) void apply_sse41(
+            uint16_t* words, size_t const count) const noexcept {
+        __m128i const tile   = _mm_set1_epi16(tile_mask);
+        __m128i const zero   = _mm_setzero_si128();
+        __m128i const offset = _mm_set1_epi16(static_cast<int16_t>(delta));
+        __m128i const index  = _mm_set1_epi16(3);
+        __m128i const keep   = _mm_set1_epi16(static_cast<int16_t>(keep_mask));
+        __m128i const toggle = _mm_set1_epi16(static_cast<int16_t>(flip_bits));
+        __m128i const set    = _mm_set1_epi16(static_cast<int16_t>(set_bits));
+        __m128i const lines  = _mm_setr_epi8(
+                static_cast<char>(palettes[0] << 5U),
+                static_cast<char>(palettes[1] << 5U),
+                static_cast<char>(palettes[2] << 5U),
+                static_cast<char>(palettes[3] << 5U), 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 0, 0, 0);
+        bool const clamp = overflow == TileOverflow::Clamp;
+        size_t     ii    = 0;
+        for (; ii + 8 <= count; ii += 8) {
+            auto* const where
+                    = static_cast<__m128i*>(static_cast<void*>(words + ii));
+            __m128i const value = _mm_loadu_si128(where);
+            __m128i       names
+                    = _mm_add_epi16(_mm_and_si128(value, tile), offset);
+            names = clamp ? _mm_min_epi16(_mm_max_epi16(names, zero), tile)
+                          : _mm_and_si128(names, tile);
+            // The palette line indexes the table in the low byte of each lane,
+            // and the high byte is shifted out.
+            __m128i const palette = _mm_slli_epi16(
+                    _mm_shuffle_epi8(
+                            lines,
+                            _mm_and_si128(
+                                    _mm_srli_epi16(value, palette_shift),
+                                    index)),
+                    8);
+            names = _mm_or_si128(
+                    _mm_or_si128(names, palette), _mm_and_si128(value, keep));
+            names = _mm_or_si128(_mm_xor_si128(names, toggle), set);
+            if (filtered) {
+                __m128i const mask = _mm_setr_epi16(
+                        is_selected(words[ii + 0]), is_selected(words[ii + 1]),
+                        is_selected(words[ii + 2]), is_selected(words[ii + 3]),
+                        is_selected(words[ii + 4]), is_selected(words[ii + 5]),
+                        is_selected(words[ii + 6]), is_selected(words[ii + 7]));
+                names = _mm_blendv_epi8(value, names, mask);
+            }
+            _mm_storeu_si128(where, names);
+        }
+        apply_scalar(words + ii, count - ii);
+    }
+
+    // All bits set if the tile of the word is selected, clear otherwise.
+    [[nodiscard]] int16_t is_selected(uint16_t const word) const noexcept {
+        return selected[word & tile_mask] ? int16_t{-1} : int16_t{0};
+    }
+#endif
+
+public:
+    Pattern_Name_Transform() noexcept {
+        selected.set();
+    }
+
+    // Adds delta to the tile index, either wrapping it around or clamping it
+    // to [0, 0x7ff] if it overflows.
+    Pattern_Name_Transform& offset_tiles(
+            int32_t const      delta_,
+            TileOverflow const overflow_ = TileOverflow::Wrap) noexcept {
+        overflow = overflow_;
+        // Normalized so that the sum always fits in 16 signed bits.
+        if (overflow == TileOverflow::Clamp) {
+            delta = std::clamp(
+                    delta_, -static_cast<int32_t>(tile_count),
+                    static_cast<int32_t>(tile_count));
+        } else {
+            delta = static_cast<int32_t>(
+                    static_cast<uint32_t>(delta_) & tile_mask);
+        }
+        return *this;
+    }
+    // Replaces palette line ii by lines[ii].
+    Pattern_Name_Transform& remap_palettes(
+            std::array<PaletteLine, 4> const& lines) noexcept {
+        for (size_t ii = 0; ii < palettes.size(); ii++) {
+            palettes[ii] = static_cast<uint8_t>(lines[ii] & 3U);
+        }
+        return *this;
+    }
+    // Adds offset (mod 4) to the palette line.
+    Pattern_Name_Transform& offset_palettes(uint32_t const offset) noexcept {
+        return remap_palettes(
+                {Line0 + offset, Line1 + offset, Line2 + offset,
+                 Line3 + offset});
+    }
+    // Toggles the given flips.
+    Pattern_Name_Transform& toggle_flip(FlipMode const flip) noexcept {
+        flip_bits = static_cast<uint16_t>(
+                static_cast<uint32_t>(flip) << flip_shift);
+        return *this;
+    }
+    // Forces the priority bit on or off.
+    Pattern_Name_Transform& set_priority(bool const priority) noexcept {
+        keep_mask = flags_mask & ~priority_mask;
+        set_bits  = priority ? priority_mask : 0U;
+        return *this;
+    }
+    // Leaves pattern names with this tile untouched, even if it is also
+    // whitelisted.
+    Pattern_Name_Transform& blacklist(uint16_t const tile) noexcept {
+        filtered = true;
+        blacklisted.set(tile & tile_mask);
+        selected.reset(tile & tile_mask);
+        return *this;
+    }
+    // Only touches pattern names with whitelisted tiles that are not also
+    // blacklisted.
+    Pattern_Name_Transform& whitelist(uint16_t const tile) noexcept {
+        if (!whitelisting) {
+            whitelisting = true;
+            filtered     = true;
+            selected.reset();
+        }
+        if (!blacklisted[tile & tile_mask]) {
+            selected.set(tile & tile_mask);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] Pattern_Name operator()(
+            Pattern_Name const pattern) const noexcept {
+        uint32_t const value = pattern.get_value();
+        uint32_t const tile  = value & tile_mask;
+        if (!selected[tile]) {
+            return pattern;
+        }
+        uint32_t const line = palettes[(value & palette_mask) >> palette_shift];
+        uint32_t const result
+                = offset_tile(tile) | (line << palette_shift)
+                  | (value & keep_mask);
+        return Pattern_Name(
+                static_cast<uint16_t>((result ^ flip_bits) | set_bits));
+    }
+
+    // Transforms all the pattern names in place.
+    void apply(std::span<Pattern_Name> patterns) const noexcept {
+        static_assert(sizeof(Pattern_Name) == sizeof(uint16_t));
+        auto* const words = static_cast<uint16_t*>(
+                static_cast<void*>(patterns.data()));
+#ifdef TILE_DISTANCE_X86
+        if (best_distance_kernel() != DistanceKernel::Scalar) {
+            apply_sse41(words, patterns.size());
+            return;
+        }
+#endif
+        apply_scalar(words, patterns.size());
+    }
+};
+
+#endif    // PATTERN_NAME_TRANSFORM_HH
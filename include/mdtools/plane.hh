@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLANE_HH
+#define PLANE_HH
+
+#include <mdcomp/enigma.hh>
+#include <mdtools/pattern_name.hh>
+#include <mdtools/pattern_name_table.hh>
+#include <mdtools/pattern_name_transform.hh>
+#include <mdtools/span_stream.hh>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// A column of a plane map: count pattern names, stride apart, from first.
+template <typename T>
+class PlaneColumn {
+    T*     first  = nullptr;
+    size_t stride = 0;
+    size_t count  = 0;
+
+public:
+    class iterator {
+        T*     current = nullptr;
+        size_t stride  = 0;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::remove_const_t<T>;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = T*;
+        using reference         = T&;
+
+        iterator() noexcept = default;
+        iterator(T* current_, size_t stride_) noexcept
+                : current(current_), stride(stride_) {}
+
+        T& operator*() const noexcept {
+            return *current;
+        }
+        iterator& operator++() noexcept {
+            current += stride;
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator value(*this);
+            ++(*this);
+            return value;
+        }
+        bool operator==(iterator const& other) const noexcept {
+            return current == other.current;
+        }
+    };
+
+    PlaneColumn() noexcept = default;
+    PlaneColumn(T* first_, size_t stride_, size_t count_) noexcept
+            : first(first_), stride(stride_), count(count_) {}
+
+    [[nodiscard]] size_t size() const noexcept {
+        return count;
+    }
+    T& operator[](size_t const index) const noexcept {
+        return first[index * stride];
+    }
+    [[nodiscard]] iterator begin() const noexcept {
+        return iterator(first, stride);
+    }
+    [[nodiscard]] iterator end() const noexcept {
+        return iterator(first + count * stride, stride);
+    }
+};
+
+// Plane map whose size is only known at run time, such as a whole nametable
+// of 64x32, 128x32 or 128x64 cells. It has the same interface as
+// Pattern_Name_Table, which is still best when the size is fixed, and keeps
+// its pattern names in a single block, one row after the other.
+class Plane {
+    size_t                    plane_width  = 0;
+    size_t                    plane_height = 0;
+    std::vector<Pattern_Name> patterns;
+
+    // The bytes of the pattern names, where words are read into in place.
+    std::span<uint8_t> bytes() noexcept {
+        return {static_cast<uint8_t*>(static_cast<void*>(patterns.data())),
+                patterns.size() * sizeof(Pattern_Name)};
+    }
+    // Turns the first count bytes of the plane, which hold big-endian words,
+    // into pattern names, and clears the rest of the plane.
+    void from_big_endian(size_t const count) noexcept {
+        uint8_t const* const data  = bytes().data();
+        size_t const         words = std::min(count / 2, patterns.size());
+        for (size_t ii = 0; ii < words; ii++) {
+            patterns[ii] = Pattern_Name(static_cast<uint16_t>(
+                    (data[ii * 2] << 8U) | data[ii * 2 + 1]));
+        }
+        std::fill(
+                patterns.begin() + static_cast<ptrdiff_t>(words),
+                patterns.end(), Pattern_Name());
+    }
+    // Converts count pattern names, starting at first, to big-endian words.
+    void pack(
+            size_t const first, size_t const count,
+            uint8_t* bytes_out) const noexcept {
+        for (size_t ii = first; ii < first + count; ii++) {
+            uint16_t const value = patterns[ii].get_value();
+            *bytes_out++         = static_cast<uint8_t>(value >> 8U);
+            *bytes_out++         = static_cast<uint8_t>(value & 0xffU);
+        }
+    }
+
+public:
+    Plane() noexcept = default;
+    Plane(size_t const width, size_t const height)
+            : plane_width(width), plane_height(height),
+              patterns(width * height) {}
+    // Both constructors decode or read the words straight into the plane.
+    // Missing words are left blank.
+    Plane(size_t const width, size_t const height, std::istream& input,
+          bool const compressed)
+            : Plane(width, height) {
+        if (compressed) {
+            SpanOutputStream output(bytes());
+            enigma::decode(input, output);
+            from_big_endian(output.size());
+        } else {
+            input.read(
+                    static_cast<char*>(static_cast<void*>(bytes().data())),
+                    static_cast<std::streamsize>(bytes().size()));
+            from_big_endian(static_cast<size_t>(input.gcount()));
+        }
+    }
+    Plane(size_t const width, size_t const height,
+          std::span<uint8_t const> input, bool const compressed)
+            : Plane(width, height) {
+        if (compressed) {
+            SpanInputStream  source(input);
+            SpanOutputStream output(bytes());
+            enigma::decode(source, output);
+            from_big_endian(output.size());
+        } else {
+            size_t const count = std::min(input.size(), bytes().size());
+            std::copy_n(input.begin(), count, bytes().begin());
+            from_big_endian(count);
+        }
+    }
+    template <unsigned table_width, unsigned table_height>
+    explicit Plane(
+            Pattern_Name_Table<table_width, table_height> const& table)
+            : Plane(table_width, table_height) {
+        for (size_t row = 0; row < table_height; row++) {
+            std::copy(table[row].cbegin(), table[row].cend(),
+                      (*this)[row].begin());
+        }
+    }
+
+    // Copies the part of the plane that fits into the table, and clears the
+    // rest of the table.
+    template <unsigned table_width, unsigned table_height>
+    void copy_to(Pattern_Name_Table<table_width, table_height>& table)
+            const noexcept {
+        size_t const copy_width = std::min<size_t>(table_width, plane_width);
+        for (size_t row = 0; row < table_height; row++) {
+            auto& line = table[row];
+            std::fill(line.begin(), line.end(), Pattern_Name());
+            if (row < plane_height) {
+                std::copy_n((*this)[row].begin(), copy_width, line.begin());
+            }
+        }
+    }
+
+    [[nodiscard]] size_t width() const noexcept {
+        return plane_width;
+    }
+    [[nodiscard]] size_t height() const noexcept {
+        return plane_height;
+    }
+
+    // Rows, columns and all the pattern names, in row-major order.
+    std::span<Pattern_Name const> operator[](size_t const row) const noexcept {
+        return std::span(patterns).subspan(row * plane_width, plane_width);
+    }
+    std::span<Pattern_Name> operator[](size_t const row) noexcept {
+        return std::span(patterns).subspan(row * plane_width, plane_width);
+    }
+    [[nodiscard]] PlaneColumn<Pattern_Name const> column(
+            size_t const column) const noexcept {
+        return {patterns.data() + column, plane_width, plane_height};
+    }
+    [[nodiscard]] PlaneColumn<Pattern_Name> column(
+            size_t const column) noexcept {
+        return {patterns.data() + column, plane_width, plane_height};
+    }
+    [[nodiscard]] std::span<Pattern_Name const> cells() const noexcept {
+        return patterns;
+    }
+    [[nodiscard]] std::span<Pattern_Name> cells() noexcept {
+        return patterns;
+    }
+
+    // Calls func on every pattern name, which it can change.
+    template <typename Func>
+    void transform(Func const& func) {
+        for (auto& pattern : patterns) {
+            func(pattern);
+        }
+    }
+    // Mirrors the plane left to right, flipping every tile to match.
+    void flip_x() noexcept {
+        for (size_t row = 0; row < plane_height; row++) {
+            auto line = (*this)[row];
+            std::reverse(line.begin(), line.end());
+        }
+        Pattern_Name_Transform().toggle_flip(XFlip).apply(patterns);
+    }
+    // Mirrors the plane top to bottom, flipping every tile to match.
+    void flip_y() noexcept {
+        for (size_t row = 0; row < plane_height / 2; row++) {
+            auto top    = (*this)[row];
+            auto bottom = (*this)[plane_height - 1 - row];
+            std::swap_ranges(top.begin(), top.end(), bottom.begin());
+        }
+        Pattern_Name_Transform().toggle_flip(YFlip).apply(patterns);
+    }
+
+    // Converts the plane to big-endian words, in a single buffer.
+    [[nodiscard]] std::vector<uint8_t> pack() const {
+        std::vector<uint8_t> buffer(patterns.size() * 2);
+        pack(0, patterns.size(), buffer.data());
+        return buffer;
+    }
+    // Writes the plane as big-endian words, a block of them at a time, so that
+    // nothing is allocated.
+    void write(std::ostream& output) const noexcept {
+        constexpr size_t const block_size = 2048;
+        std::array<uint8_t, block_size * 2> buffer;
+        for (size_t first = 0; first < patterns.size(); first += block_size) {
+            size_t const count = std::min(block_size, patterns.size() - first);
+            pack(first, count, buffer.data());
+            output.write(
+                    static_cast<char const*>(
+                            static_cast<void const*>(buffer.data())),
+                    static_cast<std::streamsize>(count * 2));
+        }
+    }
+};
+
+#endif    // PLANE_HH
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPAN_STREAM_HH
+#define SPAN_STREAM_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <streambuf>
+
+// Read-only stream over bytes in memory, which are read in place. This is for
+// passing byte buffers to code that only takes streams, such as compressors.
+// The bytes must outlive the stream.
+class SpanInputStream : public std::istream {
+    class Buffer final : public std::streambuf {
+    public:
+        explicit Buffer(std::span<uint8_t const> data) noexcept {
+            // The buffer is never written to through the get area.
+            char* begin = static_cast<char*>(
+                    const_cast<void*>(static_cast<void const*>(data.data())));
+            setg(begin, begin, begin + data.size());
+        }
+
+    protected:
+        pos_type seekoff(
+                off_type const off, std::ios_base::seekdir const dir,
+                std::ios_base::openmode const which) final {
+            if ((which & std::ios_base::in) == 0) {
+                return pos_type(off_type(-1));
+            }
+            off_type base = gptr() - eback();
+            if (dir == std::ios_base::beg) {
+                base = 0;
+            } else if (dir == std::ios_base::end) {
+                base = egptr() - eback();
+            }
+            off_type const position = base + off;
+            if (position < 0 || position > egptr() - eback()) {
+                return pos_type(off_type(-1));
+            }
+            setg(eback(), eback() + position, egptr());
+            return pos_type(position);
+        }
+        pos_type seekpos(
+                pos_type const position,
+                std::ios_base::openmode const which) final {
+            return seekoff(off_type(position), std::ios_base::beg, which);
+        }
+    };
+
+    Buffer buffer;
+
+public:
+    explicit SpanInputStream(std::span<uint8_t const> data) noexcept
+            : std::istream(nullptr), buffer(data) {
+        rdbuf(&buffer);
+    }
+};
+
+// Write-only stream into bytes in memory, which are written in place. Writing
+// past their end fails. The bytes must outlive the stream.
+class SpanOutputStream : public std::ostream {
+    class Buffer final : public std::streambuf {
+    public:
+        explicit Buffer(std::span<uint8_t> data) noexcept {
+            char* begin = static_cast<char*>(static_cast<void*>(data.data()));
+            setp(begin, begin + data.size());
+        }
+        [[nodiscard]] size_t size() const noexcept {
+            return static_cast<size_t>(pptr() - pbase());
+        }
+
+    protected:
+        pos_type seekoff(
+                off_type const off, std::ios_base::seekdir const dir,
+                std::ios_base::openmode const which) final {
+            if ((which & std::ios_base::out) == 0) {
+                return pos_type(off_type(-1));
+            }
+            off_type base = pptr() - pbase();
+            if (dir == std::ios_base::beg) {
+                base = 0;
+            } else if (dir == std::ios_base::end) {
+                base = epptr() - pbase();
+            }
+            off_type const position = base + off;
+            if (position < 0 || position > epptr() - pbase()) {
+                return pos_type(off_type(-1));
+            }
+            setp(pbase(), epptr());
+            pbump(static_cast<int>(position));
+            return pos_type(position);
+        }
+        pos_type seekpos(
+                pos_type const position,
+                std::ios_base::openmode const which) final {
+            return seekoff(off_type(position), std::ios_base::beg, which);
+        }
+    };
+
+    Buffer buffer;
+
+public:
+    explicit SpanOutputStream(std::span<uint8_t> data) noexcept
+            : std::ostream(nullptr), buffer(data) {
+        rdbuf(&buffer);
+    }
+
+    // How far into the bytes the stream is.
+    [[nodiscard]] size_t size() const noexcept {
+        return buffer.size();
+    }
+};
+
+#endif    // SPAN_STREAM_HH
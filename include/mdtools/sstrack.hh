@@ -20,20 +20,305 @@
 
 #include <mdtools/pattern_name_table.hh>
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <span>
+#include <utility>
 #include <vector>
 
 using RLEPattern = std::pair<Pattern_Name, unsigned>;
 
+// Ways of decoding track frames: one entry and one bit at a time, as the game
+// does, or with lookup tables for whole entries. Both give the same results.
+enum class TrackDecoder : uint8_t { Bitwise, Table };
+
+// Lookup tables for the indices in track frames. Symbolwise indices give a
+// pattern name; dictionary indices give a pattern name and how many more times
+// it repeats. The standard tables are those of the game, built at compile time.
+// Hacks that changed them can load theirs from the game data instead.
+class SSTrackTables {
+public:
+    // Sizes of the tables in the game. The 10-bit and 7-bit tables can be
+    // longer, up to what their indices can reach; the 7-bit index 0x7f is
+    // reserved for the end of the line.
+    constexpr static size_t const Sym_6bit_size      = 64;
+    constexpr static size_t const Sym_10bit_size     = 548;
+    constexpr static size_t const Dic_6bit_size      = 64;
+    constexpr static size_t const Dic_7bit_size      = 70;
+    constexpr static size_t const Max_sym_10bit_size = 1024;
+    constexpr static size_t const Max_dic_7bit_size  = 127;
+
+private:
+    friend class SSTrackFrame;
+    friend class SSTrackEncoder;
+
+    // Selector bit, then a 10-bit or 6-bit index; 11 or 7 bits in all.
+    struct SymEntry {
+        Pattern_Name pattern;
+        bool         valid = false;
+    };
+    // Selector bit, then a 7-bit or 6-bit index; 8 or 7 bits in all. A count
+    // of 0 marks the end of the line.
+    struct DicEntry {
+        Pattern_Name pattern;
+        bool         valid = false;
+        uint8_t      count = 0;
+    };
+    constexpr static uint32_t const Sym_bits = 11;
+    constexpr static uint32_t const Dic_bits = 8;
+    using SymTable = std::array<SymEntry, 1U << Sym_bits>;
+    using DicTable = std::array<DicEntry, 1U << Dic_bits>;
+
+    std::array<Pattern_Name, Sym_6bit_size>      sym_6bit{};
+    std::array<Pattern_Name, Max_sym_10bit_size> sym_10bit{};
+    std::array<RLEPattern, Dic_6bit_size>        dic_6bit{};
+    std::array<RLEPattern, Max_dic_7bit_size>    dic_7bit{};
+    size_t                                       sym_10bit_size = 0;
+    size_t                                       dic_7bit_size  = 0;
+    // Whole entries, as decode_table reads them: pattern names have the
+    // palette and priority of the track already set. There is one symbolwise
+    // table for each value of xflip.
+    std::array<SymTable, 2> sym_entries{};
+    DicTable                dic_entries{};
+
+    constexpr void build_entries() noexcept {
+        constexpr size_t const Width = PlaneH128V28::Width;
+        for (uint32_t ii = 0; ii < sym_entries[0].size(); ii++) {
+            Pattern_Name pattern;
+            if ((ii >> 10U) != 0) {
+                uint32_t const index = ii & 0x3ffU;
+                if (index >= sym_10bit_size) {
+                    continue;
+                }
+                pattern = sym_10bit[index];
+            } else {
+                pattern = sym_6bit[(ii >> 4U) & 0x3fU];
+            }
+            pattern.set_palette(Line3);
+            sym_entries[0][ii] = {pattern, true};
+            // Flip the pattern name; it goes from the end of line.
+            pattern.set_flip(pattern.get_flip() ^ XFlip);
+            sym_entries[1][ii] = {pattern, true};
+        }
+        for (uint32_t ii = 0; ii < dic_entries.size(); ii++) {
+            RLEPattern pattern;
+            if ((ii >> 7U) != 0) {
+                uint32_t const value = ii & 0x7fU;
+                if (value == 0x7f) {
+                    dic_entries[ii] = {Pattern_Name(), true, 0};
+                    continue;
+                }
+                if (value >= dic_7bit_size) {
+                    continue;
+                }
+                pattern = dic_7bit[value];
+            } else {
+                pattern = dic_6bit[(ii >> 1U) & 0x3fU];
+            }
+            // Runs longer than a line are invalid anyway.
+            if (pattern.second >= Width) {
+                continue;
+            }
+            pattern.first.set_palette(Line3);
+            pattern.first.set_priority(true);
+            dic_entries[ii] = {
+                    pattern.first, true,
+                    static_cast<uint8_t>(pattern.second + 1)};
+        }
+    }
+
+public:
+    // Entries past the maximum sizes of the 10-bit and 7-bit tables are
+    // ignored.
+    constexpr SSTrackTables(
+            std::span<Pattern_Name const, Sym_6bit_size> sym_6bit_,
+            std::span<Pattern_Name const>                sym_10bit_,
+            std::span<RLEPattern const, Dic_6bit_size>   dic_6bit_,
+            std::span<RLEPattern const> dic_7bit_) noexcept
+            : sym_10bit_size(std::min(sym_10bit_.size(), Max_sym_10bit_size)),
+              dic_7bit_size(std::min(dic_7bit_.size(), Max_dic_7bit_size)) {
+        std::copy(sym_6bit_.begin(), sym_6bit_.end(), sym_6bit.begin());
+        std::copy_n(sym_10bit_.begin(), sym_10bit_size, sym_10bit.begin());
+        std::copy(dic_6bit_.begin(), dic_6bit_.end(), dic_6bit.begin());
+        std::copy_n(dic_7bit_.begin(), dic_7bit_size, dic_7bit.begin());
+        build_entries();
+    }
+
+    // The tables of the game.
+    [[gnu::const]] static SSTrackTables const& standard() noexcept;
+
+    // Replaces the tables with those in data, laid out as in the game: the
+    // 6-bit and 10-bit symbolwise tables, with a big-endian pattern name for
+    // each entry, then the 6-bit and 7-bit dictionary tables, with a
+    // big-endian pattern name and run length for each entry. The tables are
+    // back to back, and the 10-bit and 7-bit ones have the given sizes. Returns
+    // false and keeps the old tables if the data is too short or the sizes are
+    // too large.
+    bool load(
+            std::span<uint8_t const> data,
+            size_t                   sym_10bit_count = Sym_10bit_size,
+            size_t dic_7bit_count = Dic_7bit_size) noexcept;
+};
+
+// Estimated 68000 cycles that the game's track decoder spends on each part of
+// its work. They are rough figures from the shape of its loops, not timings;
+// they can be changed to match the decoder of a hack.
+struct SSTrackCycleCosts {
+    // Reading one bit from any of the streams, with its share of refills.
+    uint32_t bit = 12;
+    // Looking up a symbolwise index and writing its entry.
+    uint32_t symbolwise = 30;
+    // Looking up a dictionary index, including the check for a byte-aligned
+    // 0xff, and setting up its run.
+    uint32_t dictionary = 34;
+    // Writing each entry of a dictionary run.
+    uint32_t run_entry = 18;
+    // Moving on to the next line.
+    uint32_t line_end = 40;
+};
+
+// What the game's decoder does for one line of a track frame.
+struct SSTrackLineStats {
+    // Bits read from the bit flags, symbolwise and dictionary streams.
+    uint32_t flag_bits = 0;
+    uint32_t sym_bits  = 0;
+    uint32_t dic_bits  = 0;
+    // Entries decoded with each kind of index.
+    uint32_t sym_6bit  = 0;
+    uint32_t sym_10bit = 0;
+    uint32_t dic_6bit  = 0;
+    uint32_t dic_7bit  = 0;
+    // Entries written by dictionary runs, and the longest of those runs.
+    uint32_t run_entries = 0;
+    uint32_t longest_run = 0;
+    // End of line markers, 0 if the frame ended before the line did; and how
+    // many of those were a byte-aligned 0xff, which is skipped unread.
+    uint32_t line_ends    = 0;
+    uint32_t aligned_ends = 0;
+
+    [[nodiscard]] uint32_t bits() const noexcept {
+        return flag_bits + sym_bits + dic_bits;
+    }
+    [[nodiscard]] uint32_t cycles(
+            SSTrackCycleCosts const& costs = {}) const noexcept {
+        return bits() * costs.bit
+               + (sym_6bit + sym_10bit) * costs.symbolwise
+               + (dic_6bit + dic_7bit) * costs.dictionary
+               + run_entries * costs.run_entry + line_ends * costs.line_end;
+    }
+};
+
+// What the game's decoder does for a whole track frame, line by line.
+struct SSTrackStats {
+    std::array<SSTrackLineStats, PlaneH128V28::Height> lines{};
+
+    [[nodiscard]] uint32_t cycles(
+            SSTrackCycleCosts const& costs = {}) const noexcept {
+        uint32_t total = 0;
+        for (auto const& line : lines) {
+            total += line.cycles(costs);
+        }
+        return total;
+    }
+    // The line that takes the most cycles.
+    [[nodiscard]] size_t worst_line(
+            SSTrackCycleCosts const& costs = {}) const noexcept {
+        return static_cast<size_t>(
+                std::max_element(
+                        lines.cbegin(), lines.cend(),
+                        [&](auto const& left, auto const& right) {
+                            return left.cycles(costs) < right.cycles(costs);
+                        })
+                - lines.cbegin());
+    }
+};
+
 class SSTrackFrame : public PlaneH128V28 {
 private:
-    static std::vector<Pattern_Name> SymLUT_6bit;
-    static std::vector<Pattern_Name> SymLUT_10bit;
-    static std::vector<RLEPattern>   DicLUT_6bit;
-    static std::vector<RLEPattern>   DicLUT_7bit;
+    bool valid = false;
+
+    using Segments = std::array<std::span<uint8_t const>, 3>;
+    static bool split_segments(
+            std::span<uint8_t const> input, Segments& segments) noexcept;
+
+    // Counts into stats what it does for each line, if stats is not null.
+    bool decode_bitwise(
+            Segments const& segments, bool xflip, SSTrackTables const& tables,
+            SSTrackStats* stats) noexcept;
+    bool decode_table(
+            Segments const& segments, bool xflip,
+            SSTrackTables const& tables) noexcept;
 
 public:
     SSTrackFrame() noexcept = default;
-    SSTrackFrame(std::istream& input, bool xflip) noexcept;
+    SSTrackFrame(
+            std::istream& input, bool xflip,
+            TrackDecoder         decoder = TrackDecoder::Table,
+            SSTrackTables const& tables  = SSTrackTables::standard()) noexcept;
+    // Decodes the frame directly from its data, which must hold the whole
+    // frame, without copying it.
+    SSTrackFrame(
+            std::span<uint8_t const> input, bool xflip,
+            TrackDecoder         decoder = TrackDecoder::Table,
+            SSTrackTables const& tables  = SSTrackTables::standard()) noexcept;
+    // Decodes the frame as the game does, and counts what it does for each
+    // line into stats.
+    SSTrackFrame(
+            std::span<uint8_t const> input, bool xflip, SSTrackStats& stats,
+            SSTrackTables const& tables = SSTrackTables::standard()) noexcept;
+
+    // Encodes the plane into a track frame that decodes back into it with the
+    // same xflip and tables. Each line is encoded with as few bits as the
+    // tables allow; the lines end with the first of the blank pattern names
+    // (all bits clear) that are left until the end. Returns false without
+    // writing anything if some pattern name cannot be encoded: it is not in
+    // the tables, it is on a palette line other than 3, or it is blank and
+    // comes before the end of its line. Use SSTrackEncoder to encode many
+    // frames with the same tables.
+    static bool encode(
+            PlaneH128V28 const& plane, std::ostream& output, bool xflip,
+            SSTrackTables const& tables = SSTrackTables::standard());
+
+    // False if the data was malformed: truncated, with invalid indices or with
+    // lines that are too long. What was decoded until then is kept.
+    [[nodiscard]] bool good() const noexcept {
+        return valid;
+    }
+};
+
+// Encodes planes into track frames, as SSTrackFrame::encode does. The codes of
+// each pattern name are looked up once, when the encoder is built, so it can
+// be kept for encoding many frames with the same tables.
+class SSTrackEncoder {
+public:
+    // Pattern names that the decoder can give, which are on palette line 3,
+    // are told apart by their tile, flip and priority, giving this many keys;
+    // those on other lines share one more key that no code has.
+    constexpr static uint32_t const Key_count = 1U << 14U;
+
+private:
+    // An entry as it is encoded: its code in the symbolwise or dictionary
+    // stream, and how many entries of the line it fills.
+    struct Code {
+        uint16_t code       = 0;
+        uint8_t  bits       = 0;
+        uint8_t  length     = 0;
+        bool     dictionary = false;
+    };
+    // Shortest symbolwise code of each key, and dictionary codes sorted by
+    // key.
+    std::vector<Code>                      sym_codes;
+    std::vector<std::pair<uint32_t, Code>> dic_codes;
+
+public:
+    explicit SSTrackEncoder(
+            SSTrackTables const& tables = SSTrackTables::standard());
+
+    bool encode(
+            PlaneH128V28 const& plane, std::ostream& output, bool xflip) const;
 };
 
 #endif    // SS_TRACK_HH
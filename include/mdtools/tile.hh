@@ -20,14 +20,29 @@
 
 #include <mdtools/pattern_name.hh>
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstring>
 #include <iosfwd>
 #include <iterator>
+#include <type_traits>
 
 using DistTable_t = std::array<std::array<uint32_t, 16>, 16>;
 
+// Hashes count pixels, stored one per byte, 8 pixels at a time.
+inline uint64_t hash_pixels(uint8_t const* pixels, size_t count) noexcept {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ count;
+    for (size_t ii = 0; ii < count; ii += 8) {
+        uint64_t word = 0;
+        std::memcpy(&word, pixels + ii, std::min<size_t>(8, count - ii));
+        hash ^= word * 0xff51afd7ed558ccdULL;
+        hash = ((hash << 31U) | (hash >> 33U)) * 0xc4ceb9fe1a85ec53ULL;
+    }
+    return hash ^ (hash >> 29U);
+}
+
 // Base tile class template that represents a tile with nlines lines of lsize
 // length each, for a total of lsize * nlines pixels (or half that in bytes).
 template <int lsize, int nlines>
@@ -42,7 +57,55 @@ class BaseTile {
 private:
     std::array<uint8_t, Tile_size> tile_data{};
 
-    // Complete random-access iterator for pixels in the tile.
+    // Flipping a tile whose sides are powers of 2 just toggles some bits of
+    // the positions of the pixels.
+    static constexpr bool const Xor_flips
+            = std::has_single_bit(Line_size) && std::has_single_bit(Num_lines);
+
+public:
+    // Position in the tile of the pixel that comes at position index when the
+    // tile is traversed with the given flip mode. Since all flips are their own
+    // inverses, this also gives where each pixel ends up after the flip.
+    static constexpr size_t pixel_index(
+            FlipMode const flip_, size_t const index) noexcept {
+        if constexpr (Xor_flips) {
+            return index ^ flip_mask(flip_);
+        } else {
+            size_t const column = index % lsize;
+            size_t const line   = index / lsize;
+            return (((flip_ & YFlip) != 0) ? nlines - 1 - line : line) * lsize
+                   + (((flip_ & XFlip) != 0) ? lsize - 1 - column : column);
+        }
+    }
+    // Calls func with the flip mode as a compile-time constant, so that loops
+    // on pixel_index are specialized for each flip mode.
+    template <typename Func>
+    static void with_flip(FlipMode const flip_, Func&& func) noexcept {
+        switch (flip_) {
+        case NoFlip:
+            func(std::integral_constant<FlipMode, NoFlip>{});
+            return;
+        case XFlip:
+            func(std::integral_constant<FlipMode, XFlip>{});
+            return;
+        case YFlip:
+            func(std::integral_constant<FlipMode, YFlip>{});
+            return;
+        case XYFlip:
+            func(std::integral_constant<FlipMode, XYFlip>{});
+            return;
+        }
+    }
+
+private:
+    static constexpr size_t flip_mask(FlipMode const flip_) noexcept {
+        return (((flip_ & XFlip) != 0) ? lsize - 1 : 0)
+               | (((flip_ & YFlip) != 0) ? (nlines - 1) * lsize : 0);
+    }
+
+    // Complete random-access iterator for pixels in the tile. It keeps the
+    // position in the iteration, and only maps it to a position in the tile
+    // when dereferenced.
     // Being a template class allows code reuse for const/nonconst iterators.
     template <typename T>
     class tile_iterator {
@@ -65,199 +128,31 @@ class BaseTile {
         value_type* tile_data;
         // Controls how we are iterating.
         FlipMode flip;
-        // Information about the iteration.
-        uint32_t start, finish, loc;
-        // Common logic for add 1/sub 1. No bounds checking!
-        void incr_decr(FlipMode const flip_) noexcept {
-            // We have to decide how we are going to iterate.
-            switch (flip_) {
-            case NoFlip:
-                // Simple increment. Inverse of XYFlip.
-                loc++;
-                return;
-            case XYFlip:
-                // Simple decrement. Inverse of NoFlip.
-                loc--;
-                return;
-            case XFlip:
-                // Lines in normal order, each line reversed.
-                // Inverse of YFlip.
-                // Are we at the start of a line?
-                if ((loc % lsize) == 0) {
-                    // Yes, so move to the end of the next line.
-                    loc += lsize + (lsize - 1);
-                } else {
-                    // No, so do a simple decrement.
-                    loc--;
-                }
-                return;
-            case YFlip:
-                // Lines in reverse order, each line normal.
-                // Inverse of XFlip.
-                // Are we at the end of a line?
-                if ((loc % lsize) == (lsize - 1)) {
-                    // Yes, so move to the start of the previous line.
-                    loc -= lsize + (lsize - 1);
-                } else {
-                    // No, so do a simple increment.
-                    loc++;
-                }
-                return;
-            }
+        // Position in the iteration; Tile_size at the end.
+        uint32_t loc;
+        // Where the pixel at loc is in the tile.
+        [[nodiscard]] size_t index() const noexcept {
+            return pixel_index(flip, loc);
         }
         // To simplify operator logic.
         void incr() noexcept {
-            // Have we finished iterating?
-            if (loc == Tile_size) {
-                // Go no further.
-                return;
-            }
-            if (loc == finish) {
-                // If we are at the last element, flag end of iteration an
-                // return.
-                loc = Tile_size;
-                return;
+            // Go no further if we finished iterating.
+            if (loc != Tile_size) {
+                loc++;
             }
-            incr_decr(flip);
         }
         // To simplify operator logic.
         void decr() noexcept {
-            // Have we finished iterating?
-            if (loc == Tile_size) {
-                // Return to last valid position.
-                loc = finish;
-                return;
-            }
-            if (loc == start) {
-                // Do not decrement.
-                return;
+            // Do not decrement past the start.
+            if (loc != 0) {
+                loc--;
             }
-            incr_decr(flip_xy(flip));
         }
-        void offset(difference_type delta) noexcept {
-            FlipMode flip_;
-            bool     subtract;
-            if (delta == 0) {
-                return;
-            }
-            if (delta > 0) {
-                if (loc == Tile_size) {
-                    // Go no further if we finished iterating.
-                    return;
-                }
-                if (loc == finish) {
-                    // If we are at the last element, flag end of iteration an
-                    // return.
-                    loc = Tile_size;
-                    return;
-                }
-                // Simple increment?
-                if (delta == 1) {
-                    incr_decr(flip);
-                    return;
-                }
-                flip_    = flip;
-                subtract = false;
-            } else {
-                if (loc == Tile_size) {
-                    // Return to last valid position if we had finished
-                    // iterating.
-                    loc = finish;
-                    delta++;
-                    // Do we still have to decrement?
-                    if (delta == 0) {
-                        // No, so bail out.
-                        return;
-                    }
-                }
-                if (loc == start) {
-                    // Do not decrement further.
-                    return;
-                }
-                if (delta == -1) {
-                    incr_decr(flip_xy(flip));
-                    return;
-                }
-                delta    = -delta;
-                flip_    = flip_xy(flip);
-                subtract = true;
-            }
-            uint32_t line_off  = delta % lsize;
-            uint32_t num_lines = delta / lsize;
-            uint32_t atoff     = loc % lsize;
-            uint32_t atline    = loc / lsize;
-            // Otherwise, we have to decide how we are going to iterate.
-            switch (flip_) {
-            case NoFlip:
-                // Simple increment. Inverse of XYFlip.
-                loc += delta;
-                // Are we adding with no flip or subtracting with XY flip?
-                if (subtract) {
-                    // Subtracting with XY flip. Can't overshoot start.
-                    if (loc > start) {
-                        loc = start;
-                    }
-                } else {
-                    // Adding with no flip. Must check if we went past the end.
-                    if (loc > finish) {
-                        // If we are past the end, flag end of iteration.
-                        loc = Tile_size;
-                    }
-                }
-                return;
-            case XYFlip:
-                // Simple decrement. Inverse of NoFlip.
-                loc -= delta;
-                // Are we adding with XY flip or subtracting with no flip?
-                if (subtract) {
-                    // Subtracting with no flip. Can't overshoot start.
-                    if (loc < start) {
-                        loc = start;
-                    }
-                } else {
-                    // Adding with XY flip. Must check if we went past the end.
-                    if (loc < finish) {
-                        // If we are past the end, flag end of iteration.
-                        loc = Tile_size;
-                    }
-                }
-                return;
-            case XFlip:
-                // Lines in normal order, each line reversed.
-                // Inverse of YFlip.
-                // Are we at the end of a line?
-                if (line_off > atoff) {
-                    num_lines++;
-                    atoff += lsize - line_off;
-                } else {
-                    atoff -= line_off;
-                }
-                // Can't overshoot start if subtracting with Y flip, and we
-                // must check for going past the end if adding with X flip.
-                if (num_lines + atline >= nlines) {
-                    loc = subtract ? start : static_cast<uint32_t>(Tile_size);
-                } else {
-                    loc = (atline + num_lines) * lsize + atoff;
-                }
-                return;
-            case YFlip:
-                // Lines in reverse order, each line normal.
-                // Inverse of XFlip.
-                if (line_off + atoff >= lsize) {
-                    num_lines++;
-                    atoff -= lsize - line_off;
-                } else {
-                    atoff += line_off;
-                }
-                // Can't overshoot start if subtracting with X flip, and we
-                // must check for going past the end if adding with Y flip.
-                if (num_lines > atline) {
-                    loc = subtract ? start : static_cast<uint32_t>(Tile_size);
-                } else {
-                    loc = (atline - num_lines) * lsize + atoff;
-                }
-                return;
-            }
+        void offset(difference_type const delta) noexcept {
+            // Stop at the start or at the end.
+            difference_type const target = difference_type(loc) + delta;
+            loc = static_cast<uint32_t>(std::clamp<difference_type>(
+                    target, 0, difference_type(Tile_size)));
         }
         // Subtracts rhs from lhs and returns result; this result is the number
         // of increments (if positive) of decrements (if negative) that would
@@ -268,30 +163,7 @@ class BaseTile {
                 tile_iterator<V> const& right) noexcept {
             assert(left.tile_data == right.tile_data);
             assert(left.flip == right.flip);
-            difference_type left_offset  = left.loc % lsize;
-            difference_type left_lines   = left.loc / lsize;
-            difference_type right_offset = right.loc % lsize;
-            difference_type right_lines  = right.loc / lsize;
-            switch (left.flip) {
-            case NoFlip:
-                // Simple increment. Inverse of XYFlip.
-                return difference_type(left.loc) - right.loc;
-            case XYFlip:
-                // Simple decrement. Inverse of NoFlip.
-                return difference_type(right.loc) - left.loc;
-            case XFlip:
-                // Lines in normal order, each line reversed.
-                // Inverse of YFlip.
-                return (left_lines - right_lines) * lsize
-                       + (right_offset - left_offset);
-            case YFlip:
-                // Lines in reverse order, each line normal.
-                // Inverse of XFlip.
-                return (right_lines - left_lines) * lsize
-                       + (left_offset - right_offset);
-            default:
-                assert(false);
-            }
+            return difference_type(left.loc) - right.loc;
         }
         // Checks if two iterators are at the same point in the iteration.
         template <typename U, typename V>
@@ -319,33 +191,8 @@ class BaseTile {
         tile_iterator(
                 FlipMode const flip_, value_type* const tile_,
                 bool const ending) noexcept
-                : tile_data(tile_), flip(flip_) {
-            // The values of start, finish and loc depend on flip mode:
-            switch (flip) {
-            case NoFlip:
-                // Inverse of XYFlip.
-                start  = 0;
-                finish = Tile_size - 1;
-                break;
-            case XYFlip:
-                // Inverse of NoFlip.
-                start  = Tile_size - 1;
-                finish = 0;
-                break;
-            case XFlip:
-                // Inverse of YFlip.
-                start  = lsize - 1;
-                finish = lsize * (nlines - 1);
-                break;
-            case YFlip:
-                // Inverse of XFlip.
-                start  = lsize * (nlines - 1);
-                finish = lsize - 1;
-                break;
-            }
-            // Point to start.
-            loc = ending ? static_cast<uint32_t>(Tile_size) : start;
-        }
+                : tile_data(tile_), flip(flip_),
+                  loc(ending ? static_cast<uint32_t>(Tile_size) : 0) {}
 
     public:
         // Conversion constructor that does any one of:
@@ -355,7 +202,7 @@ class BaseTile {
         template <typename U>
         explicit tile_iterator(tile_iterator<U> const& other) noexcept
                 : tile_data(other.tile_data), flip(other.flip),
-                  start(other.start), finish(other.finish), loc(other.loc) {}
+                  loc(other.loc) {}
         // Conversion assignment that does any one of:
         // * convert iterator to const_iterator;
         // * copies const_iterator to const_iterator;
@@ -365,8 +212,6 @@ class BaseTile {
             if (this != &right) {
                 tile_data = right.tile_data;
                 flip      = right.flip;
-                start     = right.start;
-                finish    = right.finish;
                 loc       = right.loc;
             }
             return *this;
@@ -469,16 +314,16 @@ class BaseTile {
         }
         // Dereferencing operators.
         value_type operator*() const noexcept {
-            return tile_data[loc];
+            return tile_data[index()];
         }
         reference operator*() noexcept {
-            return tile_data[loc];
+            return tile_data[index()];
         }
         pointer operator->() noexcept {
-            return &(tile_data[loc]);
+            return &(tile_data[index()]);
         }
         pointer operator->() const noexcept {
-            return &(tile_data[loc]);
+            return &(tile_data[index()]);
         }
         value_type operator[](difference_type index) const noexcept {
             return *operator+(index);
@@ -499,6 +344,10 @@ class BaseTile {
     BaseTile() noexcept = default;    // Uninitialized
     // From stream.
     explicit BaseTile(std::istream& input) noexcept;
+    // From Byte_size bytes in VRAM format.
+    explicit BaseTile(uint8_t const* bytes) noexcept {
+        unpack(bytes);
+    }
     // From (start, finish) range in iterators.
     template <typename Iter>
     BaseTile(
@@ -512,6 +361,29 @@ class BaseTile {
             DistTable_t const& DistTable, FlipMode flip, const_iterator start,
             const_iterator const& finish) const noexcept;
 
+    // Converts from/to Byte_size bytes in VRAM format, 2 pixels per byte.
+    void unpack(uint8_t const* bytes) noexcept {
+        for (size_t ii = 0; ii < Byte_size; ii++) {
+            tile_data[2 * ii + 0] = (bytes[ii] >> 4U) & 0x0fU;
+            tile_data[2 * ii + 1] = bytes[ii] & 0x0fU;
+        }
+    }
+    void pack(uint8_t* bytes) const noexcept {
+        for (size_t ii = 0; ii < Byte_size; ii++) {
+            bytes[ii] = static_cast<uint8_t>(
+                    (tile_data[2 * ii + 0] << 4U)
+                    | (tile_data[2 * ii + 1] & 0x0fU));
+        }
+    }
+
+    // Raw access to the pixels, one per byte, in unflipped order.
+    uint8_t const* data() const noexcept {
+        return tile_data.data();
+    }
+    uint8_t* data() noexcept {
+        return tile_data.data();
+    }
+
     // Functions for starting iteration. Note how the reverse iterators are the
     // same as forward iterators with X and Y both flipped.
     iterator begin(FlipMode const flip_) noexcept {
@@ -551,28 +423,73 @@ class BaseTile {
         return end(flip_, tile_data.data());
     }
 
+    // Returns the pixels of the tile in the order given by the flip mode.
+    std::array<uint8_t, Tile_size> flipped(
+            FlipMode const flip_) const noexcept {
+        std::array<uint8_t, Tile_size> pixels;
+        with_flip(flip_, [&](auto mode) {
+            for (size_t ii = 0; ii < Tile_size; ii++) {
+                pixels[ii] = tile_data[pixel_index(decltype(mode)::value, ii)];
+            }
+        });
+        return pixels;
+    }
+    // Sets the pixels of the tile from pixels listed in the order given by the
+    // flip mode.
+    void set_flipped(FlipMode const flip_, uint8_t const* pixels) noexcept {
+        with_flip(flip_, [&](auto mode) {
+            for (size_t ii = 0; ii < Tile_size; ii++) {
+                tile_data[ii] = pixels[pixel_index(decltype(mode)::value, ii)];
+            }
+        });
+    }
+
+    // Hash of the pixels of the tile as seen with the given flip mode.
+    uint64_t hash(FlipMode const flip_) const noexcept {
+        return hash_pixels(flipped(flip_).data(), Tile_size);
+    }
+
+    // Hash that is the same for the tile and all its flipped versions.
+    uint64_t canonical_hash() const noexcept {
+        return std::min(
+                {hash(NoFlip), hash(XFlip), hash(YFlip), hash(XYFlip)});
+    }
+
     // Draws line_count lines of the tile, starting at the position specified by
     // start iterator, to output stream out.
     void draw_tile(
             std::ostream& output, const_iterator& start,
             uint32_t line_count = nlines) const noexcept;
+
+private:
+    // Copies the pixels in the [first, last) range to dest, returning how many
+    // there were.
+    static size_t copy_range(
+            const_iterator const& first, const_iterator const& last,
+            uint8_t* dest) noexcept {
+        auto const count = static_cast<size_t>(
+                std::max<int64_t>(last - first, 0));
+        uint8_t const* source = first.tile_data;
+        size_t const   from   = first.loc;
+        with_flip(first.flip, [&](auto mode) {
+            for (size_t ii = 0; ii < count; ii++) {
+                dest[ii] = source[pixel_index(
+                        decltype(mode)::value, from + ii)];
+            }
+        });
+        return count;
+    }
 };
 
 // Constructs a tile by reading it from a stream.
 template <int lsize, int nlines>
 BaseTile<lsize, nlines>::BaseTile(std::istream& input) noexcept {
-    // Unpack nibbles to bytes as we go along.
-    for (uint32_t ii = 0; ii < Tile_size; ii += 2) {
-        unsigned value = input.get();
-        // If we reach the end-of-stream, fill the rest with zeroes.
-        if (!input.good()) {
-            tile_data[ii + 0] = 0;
-            tile_data[ii + 1] = 0;
-        } else {
-            tile_data[ii + 0] = (value >> 4U) & 0x0fU;
-            tile_data[ii + 1] = value & 0x0fU;
-        }
-    }
+    // Read the whole tile at once; if we reach the end-of-stream, the rest is
+    // left filled with zeroes.
+    std::array<char, Byte_size> buffer{};
+    input.read(buffer.data(), buffer.size());
+    unpack(static_cast<uint8_t const*>(
+            static_cast<void const*>(buffer.data())));
 }
 
 // Construct by copying from given iterators several times.
@@ -581,22 +498,21 @@ template <typename Iter>
 BaseTile<lsize, nlines>::BaseTile(
         Iter& start, Iter const& finish, FlipMode const flip_,
         uint32_t nreps) noexcept {
-    iterator dest = begin(flip_);
+    // Gather the pixels in order, then put them all in place at once.
+    std::array<uint8_t, Tile_size> pixels{};
+    size_t                         count = 0;
     // First nreps-1 repeats.
     for (uint32_t ii = 1; ii < nreps; ii++) {
-        for (Iter from(start); dest != end(flip_) && from != finish;
-             ++dest, ++from) {
-            *dest = *from;
+        for (Iter from(start); count < Tile_size && from != finish; ++from) {
+            pixels[count++] = *from;
         }
     }
     // Last repeat updates start iterator.
-    for (; dest != end(flip_) && start != finish; ++dest, ++start) {
-        *dest = *start;
-    }
-    // Fill the rest with zeroes, if needed.
-    for (; dest != end(flip_); ++dest) {
-        *dest = 0;
+    for (; count < Tile_size && start != finish; ++start) {
+        pixels[count++] = *start;
     }
+    // The rest was already filled with zeroes.
+    set_flipped(flip_, pixels.data());
 }
 
 // Computes distance between this tile and the data at the given iterators.
@@ -604,12 +520,13 @@ template <int lsize, int nlines>
 uint32_t BaseTile<lsize, nlines>::distance(
         DistTable_t const& DistTable, FlipMode flip, const_iterator start,
         const_iterator const& finish) const noexcept {
+    std::array<uint8_t, Tile_size> const left = flipped(flip);
+    std::array<uint8_t, Tile_size>       right;
+    size_t const                         count = std::min(
+            Tile_size, copy_range(start, finish, right.data()));
     uint32_t dist = 0;
-    for (const_iterator it = begin(flip); it != end(flip) && start != finish;
-         ++it, ++start) {
-        uint32_t const color_left  = *it;
-        uint32_t const color_right = *start;
-        dist += DistTable[color_left][color_right];
+    for (size_t ii = 0; ii < count; ii++) {
+        dist += DistTable[left[ii]][right[ii]];
     }
     return dist;
 }
@@ -621,12 +538,12 @@ void BaseTile<lsize, nlines>::draw_tile(
         std::ostream& output, const_iterator& start,
         uint32_t line_count) const noexcept {
     const_iterator finish = start + line_count * Line_size;
-    while (start != finish) {
-        uint8_t value = (*start++) << 4;
-        if (start != finish) {
-            value |= (*start++);
-        }
-        output.put(value);
+    // Room for a zero after an odd number of pixels.
+    std::array<uint8_t, Tile_size + 1> pixels{};
+    size_t const count = copy_range(start, finish, pixels.data());
+    start              = finish;
+    for (size_t ii = 0; ii < count; ii += 2) {
+        output.put(static_cast<char>((pixels[ii] << 4U) | pixels[ii + 1]));
     }
 }
 
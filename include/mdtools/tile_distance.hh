@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILE_DISTANCE_HH
+#define TILE_DISTANCE_HH
+
+#include <mdtools/pattern_name.hh>
+#include <mdtools/tile.hh>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define TILE_DISTANCE_X86 1
+#    include <immintrin.h>
+#endif
+
+// Implementations available for the tile distance computation. The SIMD ones
+// are only available on x86 with GCC-compatible compilers, and are selected at
+// runtime based on what the CPU supports.
+enum class DistanceKernel : uint8_t { Scalar, SSE41, AVX2 };
+
+// Returns the fastest kernel supported by the running CPU.
+inline DistanceKernel best_distance_kernel() noexcept {
+    static DistanceKernel const kernel = []() {
+#ifdef TILE_DISTANCE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") != 0) {
+            return DistanceKernel::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1") != 0) {
+            return DistanceKernel::SSE41;
+        }
+#endif
+        return DistanceKernel::Scalar;
+    }();
+    return kernel;
+}
+
+// Builds a distance table for comparing tiles shown with the tile_line palette
+// line against tiles shown with the query_line palette line, both given in the
+// Mega Drive format (0BGR, 3 bits per channel). Entry [ii][jj] is the squared
+// euclidean distance between color ii of tile_line and color jj of query_line,
+// except that color 0 is transparent in every line, and so matches itself.
+inline DistTable_t palette_dist_table(
+        std::span<uint16_t const, 16> tile_line,
+        std::span<uint16_t const, 16> query_line) {
+    auto const channel = [](uint32_t const color, uint32_t const shift) {
+        return static_cast<int>((color >> shift) & 0xfU);
+    };
+    auto const distance = [&channel](
+                                  uint32_t const color1,
+                                  uint32_t const color2) -> uint32_t {
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift < 12; shift += 4) {
+            int const delta = channel(color1, shift) - channel(color2, shift);
+            result += static_cast<uint32_t>(delta * delta);
+        }
+        return result;
+    };
+    DistTable_t table{};
+    for (size_t ii = 0; ii < 16; ii++) {
+        for (size_t jj = 0; jj < 16; jj++) {
+            table[ii][jj] = distance(tile_line[ii], query_line[jj]);
+        }
+    }
+    table[0][0] = 0;
+    return table;
+}
+
+// Distance table for tiles shown with the same palette line.
+inline DistTable_t palette_dist_table(std::span<uint16_t const, 16> palette) {
+    return palette_dist_table(palette, palette);
+}
+
+// The distance table split into bytes and transposed, so that the column for a
+// given color of the query tile can be used as a 16-entry byte shuffle table
+// indexed by the colors of the other tile.
+struct DistanceLUT {
+    alignas(16) std::array<std::array<uint8_t, 16>, 16> low;
+    alignas(16) std::array<std::array<uint8_t, 16>, 16> high;
+
+    // Returns false if some entry does not fit in 16 bits, in which case the
+    // SIMD kernels cannot be used.
+    bool build(DistTable_t const& table) noexcept {
+        for (size_t ii = 0; ii < 16; ii++) {
+            for (size_t jj = 0; jj < 16; jj++) {
+                uint32_t const value = table[jj][ii];
+                if (value > 0xffffU) {
+                    return false;
+                }
+                low[ii][jj]  = static_cast<uint8_t>(value & 0xffU);
+                high[ii][jj] = static_cast<uint8_t>(value >> 8U);
+            }
+        }
+        return true;
+    }
+};
+
+// Color counts of a tile, used for computing lower bounds for the distance
+// between tiles regardless of how they are flipped. Also holds, for each
+// color, the smallest distance from any color in the tile to it, according to
+// the given table.
+struct ColorHistogram {
+    std::array<uint32_t, 16> counts{};
+    std::array<uint32_t, 16> nearest{};
+    uint32_t                 colors = 0;
+
+    ColorHistogram() noexcept = default;
+    ColorHistogram(
+            DistTable_t const& table, uint8_t const* pixels,
+            size_t count) noexcept {
+        for (size_t ii = 0; ii < count; ii++) {
+            uint32_t const color = pixels[ii] & 0xfU;
+            counts[color]++;
+            colors |= 1U << color;
+        }
+        for (size_t ii = 0; ii < 16; ii++) {
+            nearest[ii] = ~0U;
+            for (uint32_t bits = colors; bits != 0; bits &= bits - 1) {
+                nearest[ii] = std::min(
+                        nearest[ii], table[std::countr_zero(bits)][ii]);
+            }
+        }
+    }
+};
+
+// Sums table[left[ii]][right[ii]] for all ii < count. All the kernels stop
+// early, returning a partial sum, once the sum goes above limit.
+inline uint32_t distance_scalar(
+        DistTable_t const& table, uint8_t const* left, uint8_t const* right,
+        size_t count, uint32_t limit) noexcept {
+    uint32_t dist = 0;
+    for (size_t ii = 0; ii < count; ii += 8) {
+        for (size_t jj = ii; jj < std::min(ii + 8, count); jj++) {
+            dist += table[left[jj] & 0xfU][right[jj] & 0xfU];
+        }
+        if (dist > limit) {
+            break;
+        }
+    }
+    return dist;
+}
+
+#ifdef TILE_DISTANCE_X86
+// The kernels below look up the distance of all pixels in a vector at once:
+// for each color present in the right tile, the column of the table for that
+// color is used as a byte shuffle indexed by the left pixels, and the result is
+// kept only for the pixels where the right tile has that color. The low and
+// high bytes of the distances are then summed separately with psadbw.
+__attribute__((target("sse4.1"))) inline uint32_t distance_sse41(
+        DistanceLUT const& lut, uint8_t const* left, uint8_t const* right,
+        size_t count, uint32_t colors, uint32_t limit) noexcept {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i       sum  = zero;
+    for (size_t ii = 0; ii < count; ii += 16) {
+        __m128i const lpix = _mm_loadu_si128(
+                static_cast<__m128i const*>(static_cast<void const*>(left + ii)));
+        __m128i const rpix = _mm_loadu_si128(static_cast<__m128i const*>(
+                static_cast<void const*>(right + ii)));
+        __m128i       low  = zero;
+        __m128i       high = zero;
+        for (uint32_t bits = colors; bits != 0; bits &= bits - 1) {
+            auto const    color = static_cast<size_t>(std::countr_zero(bits));
+            __m128i const mask  = _mm_cmpeq_epi8(
+                    rpix, _mm_set1_epi8(static_cast<char>(color)));
+            __m128i const lrow = _mm_load_si128(static_cast<__m128i const*>(
+                    static_cast<void const*>(lut.low[color].data())));
+            __m128i const hrow = _mm_load_si128(static_cast<__m128i const*>(
+                    static_cast<void const*>(lut.high[color].data())));
+            low  = _mm_or_si128(
+                    low, _mm_and_si128(mask, _mm_shuffle_epi8(lrow, lpix)));
+            high = _mm_or_si128(
+                    high, _mm_and_si128(mask, _mm_shuffle_epi8(hrow, lpix)));
+        }
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(low, zero));
+        sum = _mm_add_epi64(sum, _mm_slli_epi64(_mm_sad_epu8(high, zero), 8));
+        auto const dist = static_cast<uint32_t>(
+                _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 2));
+        if (dist > limit || ii + 16 >= count) {
+            return dist;
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("avx2"))) inline uint32_t distance_avx2(
+        DistanceLUT const& lut, uint8_t const* left, uint8_t const* right,
+        size_t count, uint32_t colors, uint32_t limit) noexcept {
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i       sum  = zero;
+    for (size_t ii = 0; ii < count; ii += 32) {
+        __m256i const lpix = _mm256_loadu_si256(static_cast<__m256i const*>(
+                static_cast<void const*>(left + ii)));
+        __m256i const rpix = _mm256_loadu_si256(static_cast<__m256i const*>(
+                static_cast<void const*>(right + ii)));
+        __m256i       low  = zero;
+        __m256i       high = zero;
+        for (uint32_t bits = colors; bits != 0; bits &= bits - 1) {
+            auto const    color = static_cast<size_t>(std::countr_zero(bits));
+            __m256i const mask  = _mm256_cmpeq_epi8(
+                    rpix, _mm256_set1_epi8(static_cast<char>(color)));
+            __m256i const lrow = _mm256_broadcastsi128_si256(
+                    _mm_load_si128(static_cast<__m128i const*>(
+                            static_cast<void const*>(lut.low[color].data()))));
+            __m256i const hrow = _mm256_broadcastsi128_si256(
+                    _mm_load_si128(static_cast<__m128i const*>(
+                            static_cast<void const*>(lut.high[color].data()))));
+            low  = _mm256_or_si256(
+                    low,
+                    _mm256_and_si256(mask, _mm256_shuffle_epi8(lrow, lpix)));
+            high = _mm256_or_si256(
+                    high,
+                    _mm256_and_si256(mask, _mm256_shuffle_epi8(hrow, lpix)));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(low, zero));
+        sum = _mm256_add_epi64(
+                sum, _mm256_slli_epi64(_mm256_sad_epu8(high, zero), 8));
+        __m128i const half = _mm_add_epi64(
+                _mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        auto const dist = static_cast<uint32_t>(
+                _mm_cvtsi128_si32(half) + _mm_extract_epi32(half, 2));
+        if (dist > limit || ii + 32 >= count) {
+            return dist;
+        }
+    }
+    return 0;
+}
+#endif
+
+// Precomputed state for comparing one tile against many others. The tile is
+// stored once for each flip mode, rearranged so that comparing it with the
+// other tile in plain order gives the same result as comparing the flipped
+// other tile with this one in plain order; this works because all flips are
+// their own inverses. The result is the same as BaseTile::distance.
+template <typename Tile_t>
+class TileDistance {
+public:
+    static constexpr size_t const Tile_size = Tile_t::Tile_size;
+
+private:
+    DistTable_t const* table;
+    DistanceLUT        lut{};
+    alignas(32) std::array<std::array<uint8_t, Tile_size>, 4> arranged{};
+    ColorHistogram histogram;
+    // For each color, the smallest distance to a color in the query tile.
+    std::array<uint32_t, 16> nearest{};
+    uint32_t                 colors = 0;
+    DistanceKernel           kernel;
+    // Pruning only works if no sum of distances can overflow.
+    bool can_prune = true;
+
+public:
+    TileDistance(
+            DistTable_t const& table_, Tile_t const& tile,
+            DistanceKernel kernel_ = best_distance_kernel()) noexcept
+            : table(&table_), kernel(kernel_) {
+        static constexpr std::array<FlipMode, 4> const modes{
+                NoFlip, XFlip, YFlip, XYFlip};
+        for (auto const mode : modes) {
+            arranged[mode] = tile.flipped(mode);
+        }
+        histogram = ColorHistogram(table_, arranged[NoFlip].data(), Tile_size);
+        colors    = histogram.colors;
+        for (auto const& row : table_) {
+            uint32_t const worst = *std::max_element(row.cbegin(), row.cend());
+            if (worst > ~0U / Tile_size) {
+                can_prune = false;
+            }
+        }
+        for (size_t ii = 0; ii < 16; ii++) {
+            nearest[ii] = ~0U;
+            for (uint32_t bits = colors; bits != 0; bits &= bits - 1) {
+                nearest[ii] = std::min(
+                        nearest[ii], table_[ii][std::countr_zero(bits)]);
+            }
+        }
+        // The SIMD kernels work on whole vectors only.
+        if (kernel == DistanceKernel::AVX2 && (Tile_size % 32) != 0) {
+            kernel = DistanceKernel::SSE41;
+        }
+        if ((Tile_size % 16) != 0 || !lut.build(table_)) {
+            kernel = DistanceKernel::Scalar;
+        }
+    }
+
+    // Hash of the query tile that is the same for all its flipped versions;
+    // matches BaseTile::canonical_hash.
+    uint64_t canonical_hash() const noexcept {
+        uint64_t hash = ~0ULL;
+        for (auto const& pixels : arranged) {
+            hash = std::min(hash, hash_pixels(pixels.data(), Tile_size));
+        }
+        return hash;
+    }
+
+    // Checks if the given tile, read with the given flip mode, is identical to
+    // the query tile.
+    bool matches(Tile_t const& other, FlipMode flip) const noexcept {
+        return std::memcmp(other.data(), arranged[flip].data(), Tile_size) == 0;
+    }
+
+    // Lower bound for the distance between the query tile and the tile with
+    // the given histogram, in any flip mode: every pixel must be paired with
+    // some pixel of the other tile, and so costs at least the distance to the
+    // closest color the other tile has. The histogram must have been built
+    // with the same distance table as this object.
+    uint32_t lower_bound(ColorHistogram const& other) const noexcept {
+        if (!can_prune) {
+            return 0;
+        }
+        uint32_t left  = 0;
+        uint32_t right = 0;
+        // Colors that are absent have a count of zero, so the loop can go
+        // through all of them and be vectorized.
+        for (size_t ii = 0; ii < 16; ii++) {
+            left += other.counts[ii] * nearest[ii];
+            right += histogram.counts[ii] * other.nearest[ii];
+        }
+        return std::max(left, right);
+    }
+
+    // Computes the distance between the given tile, read with the given flip
+    // mode, and the query tile. If the distance is larger than limit, the
+    // result is some value larger than limit.
+    uint32_t operator()(
+            Tile_t const& other, FlipMode flip,
+            uint32_t limit = ~0U) const noexcept {
+        uint8_t const* left  = other.data();
+        uint8_t const* right = arranged[flip].data();
+        if (!can_prune) {
+            limit = ~0U;
+        }
+        switch (kernel) {
+#ifdef TILE_DISTANCE_X86
+        case DistanceKernel::AVX2:
+            return distance_avx2(lut, left, right, Tile_size, colors, limit);
+        case DistanceKernel::SSE41:
+            return distance_sse41(lut, left, right, Tile_size, colors, limit);
+#else
+        case DistanceKernel::AVX2:
+        case DistanceKernel::SSE41:
+#endif
+        case DistanceKernel::Scalar:
+            break;
+        }
+        return distance_scalar(*table, left, right, Tile_size, limit);
+    }
+};
+
+#endif    // TILE_DISTANCE_HH
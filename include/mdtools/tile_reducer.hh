@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILE_REDUCER_HH
+#define TILE_REDUCER_HH
+
+#include <mdtools/parallel_for.hh>
+#include <mdtools/pattern_name.hh>
+#include <mdtools/tile.hh>
+#include <mdtools/tile_distance.hh>
+#include <mdtools/vram.hh>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Lossy reduction of a set of tiles to a smaller set of representatives
+// (medoids), each tile being replaced by the closest representative in any
+// flip mode. The representatives are chosen by k-medoids: seeded by repeatedly
+// taking the tile that is worst represented so far, then refined by assigning
+// every tile to its closest representative and moving each representative to
+// the member of its cluster that represents the cluster best. Distances are
+// weighted by how often each tile is used. The result is deterministic, no
+// matter how many threads are used.
+template <typename Tile_t>
+class TileReducer {
+public:
+    // Which tile stands in for a tile, and the flip that turns it into the
+    // closest approximation of the latter.
+    struct Choice {
+        uint32_t medoid;
+        FlipMode flip;
+        uint32_t distance;
+    };
+    // Representatives are looked up through pattern names.
+    static constexpr size_t const Max_tiles = 0x800;
+
+private:
+    static constexpr std::array<FlipMode, 4> const modes{
+            NoFlip, XFlip, YFlip, XYFlip};
+    // Tiles handed to each thread at a time when seeding.
+    static constexpr size_t const Chunk_size = 64;
+
+    std::span<Tile_t const>   tiles;
+    std::span<uint32_t const> weights;
+    DistTable_t               table;
+    std::vector<bool>         fixed;
+    size_t                    fixed_count = 0;
+    unsigned                  num_threads;
+
+    [[nodiscard]] uint64_t weight(size_t const index) const noexcept {
+        return std::max<uint64_t>(weights[index], 1);
+    }
+
+    // Smallest distance in any flip mode. If it is larger than limit, the
+    // result is some value larger than limit.
+    static uint32_t distance(
+            TileDistance<Tile_t> const& query, Tile_t const& other,
+            uint32_t limit) noexcept {
+        uint32_t best = ~0U;
+        for (auto const mode : modes) {
+            best  = std::min(best, query(other, mode, limit));
+            limit = std::min(limit, best);
+        }
+        return best;
+    }
+
+    // Sum of the weighted distances between the given tile and the members
+    // of a cluster. If it is not smaller than limit, the result is some value
+    // not smaller than limit.
+    [[nodiscard]] uint64_t cost(
+            size_t const candidate, std::vector<uint32_t> const& members,
+            uint64_t const limit) const noexcept {
+        TileDistance<Tile_t> const query(table, tiles[candidate]);
+        uint64_t                   total = 0;
+        for (auto const member : members) {
+            if (member == candidate) {
+                continue;
+            }
+            uint64_t const left  = (limit - total) / weight(member);
+            auto const     bound = static_cast<uint32_t>(
+                    std::min<uint64_t>(left, ~0U));
+            total += weight(member) * distance(query, tiles[member], bound);
+            if (total >= limit) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    // Closest representative for every tile.
+    [[nodiscard]] std::vector<Choice> assign(
+            std::vector<uint32_t> const& medoids) const {
+        VRAM<Tile_t> vram;
+        vram.get_dist_table() = table;
+        vram.reserve_tiles(medoids.size());
+        for (auto const index : medoids) {
+            vram.push_back(tiles[index]);
+        }
+        auto const matches = vram.find_closest(tiles, num_threads);
+        std::vector<Choice> choices(tiles.size());
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            Pattern_Name const& pattern = matches[ii].pattern;
+            choices[ii]                 = {
+                    medoids[pattern.get_tile()], pattern.get_flip(),
+                    matches[ii].distance};
+        }
+        // A representative may be identical to another one; it must still
+        // stand for itself.
+        for (auto const index : medoids) {
+            choices[index] = {index, NoFlip, 0};
+        }
+        return choices;
+    }
+
+    // Initial representatives: the fixed tiles, then whichever tile adds the
+    // most to the weighted distance to the closest representative, until
+    // there are count of them or all tiles are represented exactly.
+    [[nodiscard]] std::vector<uint32_t> seed(size_t const count) const {
+        std::vector<uint32_t> medoids;
+        std::vector<uint32_t> nearest(tiles.size(), ~0U);
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            if (fixed[ii]) {
+                medoids.push_back(static_cast<uint32_t>(ii));
+            }
+        }
+        if (!medoids.empty()) {
+            auto const choices = assign(medoids);
+            for (size_t ii = 0; ii < tiles.size(); ii++) {
+                nearest[ii] = choices[ii].distance;
+            }
+        }
+        size_t const chunks = (tiles.size() + Chunk_size - 1) / Chunk_size;
+        while (medoids.size() < count) {
+            size_t   worst       = 0;
+            uint64_t worst_score = 0;
+            for (size_t ii = 0; ii < tiles.size(); ii++) {
+                uint64_t const score = weight(ii) * nearest[ii];
+                if (score > worst_score) {
+                    worst       = ii;
+                    worst_score = score;
+                }
+            }
+            if (worst_score == 0) {
+                break;
+            }
+            medoids.push_back(static_cast<uint32_t>(worst));
+            nearest[worst] = 0;
+            TileDistance<Tile_t> const query(table, tiles[worst]);
+            parallel_for(chunks, num_threads, [&](size_t const chunk) {
+                size_t const first = chunk * Chunk_size;
+                size_t const last
+                        = std::min(first + Chunk_size, tiles.size());
+                for (size_t ii = first; ii < last; ii++) {
+                    nearest[ii] = std::min(
+                            nearest[ii],
+                            distance(query, tiles[ii], nearest[ii]));
+                }
+            });
+        }
+        std::sort(medoids.begin(), medoids.end());
+        return medoids;
+    }
+
+public:
+    TileReducer(
+            DistTable_t const& table_, std::span<Tile_t const> tiles_,
+            std::span<uint32_t const> weights_, unsigned num_threads_ = 0)
+            : tiles(tiles_), weights(weights_), table(table_),
+              fixed(tiles_.size(), false), num_threads(num_threads_) {}
+
+    // Marks the tile as one that must be kept as it is. Fixed tiles count
+    // towards the target, and can stand in for other tiles.
+    void keep(size_t const index) {
+        if (!fixed[index]) {
+            fixed[index] = true;
+            fixed_count++;
+        }
+    }
+    // Whether the fixed tiles fit in Max_tiles, which reduce needs.
+    [[nodiscard]] bool can_reduce() const noexcept {
+        return fixed_count <= Max_tiles;
+    }
+
+    // Chooses at most count representatives (but never fewer than the fixed
+    // tiles, and never more than Max_tiles), and returns the choice for each
+    // tile. Representatives stand for themselves, with no flip. Returns no
+    // choices if there are more than Max_tiles fixed tiles.
+    [[nodiscard]] std::vector<Choice> reduce(
+            size_t count, unsigned const max_rounds = 16) const {
+        if (!can_reduce()) {
+            return {};
+        }
+        count = std::min(count, Max_tiles);
+        std::vector<uint32_t> medoids = seed(count);
+        for (unsigned round = 0; round < max_rounds; round++) {
+            auto const choices = assign(medoids);
+            // Members of the cluster of each representative.
+            std::vector<uint32_t> cluster(tiles.size(), 0);
+            for (size_t ii = 0; ii < medoids.size(); ii++) {
+                cluster[medoids[ii]] = static_cast<uint32_t>(ii);
+            }
+            std::vector<std::vector<uint32_t>> members(medoids.size());
+            for (size_t ii = 0; ii < tiles.size(); ii++) {
+                members[cluster[choices[ii].medoid]].push_back(
+                        static_cast<uint32_t>(ii));
+            }
+            std::vector<uint32_t> moved(medoids);
+            parallel_for(medoids.size(), num_threads, [&](size_t const ii) {
+                if (fixed[medoids[ii]] || members[ii].size() <= 1) {
+                    return;
+                }
+                uint64_t best_cost = cost(medoids[ii], members[ii], ~0ULL);
+                for (auto const member : members[ii]) {
+                    uint64_t const total = cost(member, members[ii], best_cost);
+                    if (total < best_cost) {
+                        moved[ii] = member;
+                        best_cost = total;
+                    }
+                }
+            });
+            std::sort(moved.begin(), moved.end());
+            if (moved == medoids) {
+                break;
+            }
+            medoids = std::move(moved);
+        }
+        return assign(medoids);
+    }
+};
+
+#endif    // TILE_REDUCER_HH
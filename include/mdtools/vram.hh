@@ -18,22 +18,251 @@
 #ifndef VRAM_HH
 #define VRAM_HH
 
+#include <mdtools/packed_tile.hh>
+#include <mdtools/parallel_for.hh>
 #include <mdtools/pattern_name.hh>
 #include <mdtools/tile.hh>
+#include <mdtools/tile_distance.hh>
 
+#include <algorithm>
 #include <array>
-#include <iosfwd>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
-// Template class with basic VRAM functionality.
+// Template class with basic VRAM functionality. The tiles are kept packed, as
+// the VDP does, and are only unpacked for computing distances.
 template <typename Tile_t>
 class VRAM {
 public:
-    using Tiles = std::vector<Tile_t>;
+    using Packed_t = BasePackedTile<
+            static_cast<int>(Tile_t::Line_size),
+            static_cast<int>(Tile_t::Num_lines)>;
+    using Tiles    = std::vector<Packed_t>;
+    static_assert(std::is_same_v<typename Packed_t::Unpacked, Tile_t>);
 
 private:
     Tiles       tiles;
     DistTable_t distTable = {};
+    // Maps the flip-invariant hash of the tiles to their positions, for finding
+    // exact matches quickly. It is only valid for the first indexed tiles, and
+    // is brought up to date when needed.
+    mutable std::unordered_multimap<uint64_t, uint32_t> exact_index;
+    mutable size_t                                      indexed = 0;
+    // Color histograms of the tiles, for pruning the search for near matches.
+    // They depend on the distance table they were built with.
+    mutable std::vector<ColorHistogram> histograms;
+    mutable DistTable_t                 histogram_table = {};
+    // Distance tables for every pair of palette lines, indexed by the line of
+    // the query tile and then by the line of the tiles in VRAM, and the color
+    // histograms of the tiles for each of them. Only used if a palette was set.
+    std::array<std::array<DistTable_t, 4>, 4>           line_tables{};
+    bool                                                has_palette = false;
+    mutable std::array<std::vector<ColorHistogram>, 16> line_histograms;
+    // Serializes updates of the index, so that const methods can be called
+    // from several threads at once. Copies get a mutex of their own.
+    struct IndexMutex {
+        std::mutex mutex;
+
+        IndexMutex() = default;
+        IndexMutex(IndexMutex const& /*other*/) noexcept {}
+        IndexMutex& operator=(IndexMutex const& /*other*/) noexcept {
+            return *this;
+        }
+    };
+    mutable IndexMutex index_mutex;
+
+    // Drops the index. Must be called whenever the tiles may have been
+    // modified by the user.
+    void invalidate_index() noexcept {
+        exact_index.clear();
+        indexed = 0;
+        histograms.clear();
+        for (auto& line : line_histograms) {
+            line.clear();
+        }
+    }
+    // Adds any tiles not yet in the index.
+    void update_index() const {
+        std::lock_guard<std::mutex> const lock(index_mutex.mutex);
+        for (; indexed < tiles.size(); indexed++) {
+            exact_index.emplace(
+                    tiles[indexed].canonical_hash(),
+                    static_cast<uint32_t>(indexed));
+        }
+        if (histogram_table != distTable) {
+            histograms.clear();
+            histogram_table = distTable;
+        }
+        for (size_t ii = histograms.size(); ii < tiles.size(); ii++) {
+            Tile_t const tile = tiles[ii].unpack();
+            histograms.emplace_back(distTable, tile.data(), Tile_t::Tile_size);
+        }
+        if (!has_palette) {
+            return;
+        }
+        for (size_t line = 0; line < line_histograms.size(); line++) {
+            auto const& table = line_tables[line / 4][line % 4];
+            auto&       hists = line_histograms[line];
+            for (size_t ii = hists.size(); ii < tiles.size(); ii++) {
+                Tile_t const tile = tiles[ii].unpack();
+                hists.emplace_back(table, tile.data(), Tile_t::Tile_size);
+            }
+        }
+    }
+    // Exact matches can only stand in for the full search if a distance of 0
+    // means that the pixels are the same.
+    static bool zero_distance_is_exact(DistTable_t const& table) noexcept {
+        for (size_t ii = 0; ii < 16; ii++) {
+            for (size_t jj = 0; jj < 16; jj++) {
+                if ((table[ii][jj] == 0) != (ii == jj)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    // Finds the first tile in [first, last) that, in the first flip mode tried
+    // by find_closest, is identical to the query tile. This works on the packed
+    // tiles: a tile read with a flip mode is the query tile if it is the query
+    // tile with the same flip mode applied.
+    bool find_exact(
+            Packed_t const& query, size_t first, size_t last,
+            Pattern_Name& best) const {
+        static constexpr std::array<FlipMode, 4> const modes{
+                NoFlip, XFlip, YFlip, XYFlip};
+        std::array<Packed_t, 4> arranged;
+        for (auto const mode : modes) {
+            arranged[mode] = query.flipped(mode);
+        }
+        bool found      = false;
+        auto [beg, end] = exact_index.equal_range(query.canonical_hash());
+        for (; beg != end; ++beg) {
+            uint32_t const index = beg->second;
+            if (index < first || index >= last
+                || (found && index >= best.get_tile())) {
+                continue;
+            }
+            for (auto const mode : modes) {
+                if (tiles[index] == arranged[mode]) {
+                    best = Pattern_Name(index);
+                    best.set_flip(mode);
+                    found = true;
+                    break;
+                }
+            }
+        }
+        return found;
+    }
+
+    // Finds the best match for the query among the tiles in [first, last), as
+    // described in find_closest, using the given distance table and the color
+    // histograms built with it. The packed query is for finding exact matches.
+    // The index must be up to date.
+    uint32_t search(
+            TileDistance<Tile_t> const& query, Packed_t const& packed,
+            DistTable_t const& table, std::vector<ColorHistogram> const& hists,
+            size_t first, size_t last, Pattern_Name& best) const {
+        if (zero_distance_is_exact(table)
+            && find_exact(packed, first, last, best)) {
+            return 0;
+        }
+        // Want to compare using all possible flips.
+        static constexpr std::array<FlipMode, 4> const modes{
+                NoFlip, XFlip, YFlip, XYFlip};
+
+        // Min-heap of candidates keyed on their lower bound, then position.
+        // The buffer is kept for the next search on the same thread.
+        thread_local std::vector<uint64_t> candidates;
+        candidates.clear();
+        for (size_t ii = first; ii < last; ii++) {
+            uint64_t const bound = query.lower_bound(hists[ii]);
+            candidates.push_back((bound << 32U) | ii);
+        }
+        std::make_heap(candidates.begin(), candidates.end(), std::greater<>());
+
+        // Start with "infinite" distance.
+        uint32_t best_dist  = ~0U;
+        size_t   best_index = last;
+        while (!candidates.empty()) {
+            std::pop_heap(
+                    candidates.begin(), candidates.end(), std::greater<>());
+            uint64_t const key = candidates.back();
+            candidates.pop_back();
+            auto const bound = static_cast<uint32_t>(key >> 32U);
+            auto const index = static_cast<uint32_t>(key);
+            if (bound > best_dist) {
+                // No remaining tile can do better.
+                break;
+            }
+            if (index > best_index && bound == best_dist) {
+                continue;
+            }
+            // Only a tile before the current best can win with the same
+            // distance, and there must be some improvement over "infinity".
+            uint32_t limit = (index < best_index && best_dist != ~0U)
+                                     ? best_dist
+                                     : best_dist - 1;
+            Tile_t const tile = tiles[index].unpack();
+            for (auto const mode : modes) {
+                uint32_t const dist = query(tile, mode, limit);
+                if (dist <= limit) {
+                    // Set new best.
+                    best = Pattern_Name(index);
+                    best.set_flip(mode);
+                    best_dist  = dist;
+                    best_index = index;
+                    if (dist == 0) {
+                        break;
+                    }
+                    // Later flip modes need to be strictly better.
+                    limit = dist - 1;
+                }
+            }
+        }
+        return best_dist;
+    }
+    // Search for find_closest with palette lines: tries the tiles with every
+    // palette line, starting with that of the query tile.
+    uint32_t search_lines(
+            Tile_t const& tile, PaletteLine const line,
+            Pattern_Name& best) const {
+        Packed_t const packed(tile);
+        uint32_t       best_dist = ~0U;
+        for (uint32_t ii = 0; ii < 4; ii++) {
+            PaletteLine const          target = line + ii;
+            auto const&                table  = line_tables[line][target];
+            TileDistance<Tile_t> const query(table, tile);
+            Pattern_Name               pattern;
+            uint32_t const             dist = search(
+                    query, packed, table, line_histograms[line * 4 + target],
+                    0, tiles.size(), pattern);
+            if (dist < best_dist) {
+                best = pattern;
+                best.set_palette(target);
+                best_dist = dist;
+                if (dist == 0) {
+                    break;
+                }
+            }
+        }
+        return best_dist;
+    }
+
+    // Converts count tiles, starting at first, to VRAM format.
+    void pack(
+            size_t const first, size_t const count,
+            uint8_t* bytes) const noexcept {
+        for (size_t ii = first; ii < first + count; ii++) {
+            tiles[ii].write(bytes);
+            bytes += Tile_t::Byte_size;
+        }
+    }
 
 public:
     // Constructor.
@@ -42,26 +271,47 @@ class VRAM {
     }
 
     explicit VRAM(std::istream& input) noexcept {
-        tiles.reserve(400);
-
-        // Just read in tiles.
+        // Read in the rest of the stream in large chunks, then convert all of
+        // it at once.
+        constexpr size_t const chunk_size = 65536;
+        std::vector<uint8_t>   buffer;
         while (input.good()) {
-            Tile_t tile(input);
-            if (!input.good()) {
-                break;
-            }
-            tiles.push_back(tile);
+            size_t const used = buffer.size();
+            buffer.resize(used + chunk_size);
+            input.read(
+                    static_cast<char*>(
+                            static_cast<void*>(buffer.data() + used)),
+                    chunk_size);
+            buffer.resize(used + static_cast<size_t>(input.gcount()));
         }
+        append_tiles(buffer);
+    }
+    // From art in VRAM format, such as the contents of a MappedFile.
+    explicit VRAM(std::span<uint8_t const> art) noexcept {
+        append_tiles(art);
     }
 
     void reserve_tiles(size_t count) {
         tiles.reserve(count);
     }
-    Tile_t& new_tile() {
-        tiles.emplace_back();
-        return tiles.back();
+    [[nodiscard]] size_t size() const noexcept {
+        return tiles.size();
+    }
+    // All tiles, packed, including any beyond the reach of pattern names.
+    [[nodiscard]] Tiles const& get_tiles() const noexcept {
+        return tiles;
+    }
+    // Appends all tiles in the given art, in VRAM format. A partial tile at the
+    // end is ignored.
+    void append_tiles(std::span<uint8_t const> art) {
+        size_t const count = art.size() / Tile_t::Byte_size;
+        tiles.reserve(tiles.size() + count);
+        uint8_t const* bytes = art.data();
+        for (size_t ii = 0; ii < count; ii++) {
+            tiles.emplace_back(bytes);
+            bytes += Tile_t::Byte_size;
+        }
     }
-
     auto& get_dist_table() const {
         return distTable;
     }
@@ -78,27 +328,25 @@ class VRAM {
     void copy_dist_table(VRAM<T> const& other) {
         distTable = other.get_dist_table();
     }
-    // Gets the referred tile. No bounds checking!
-    Tile_t& get_tile(Pattern_Name const& pattern) noexcept {
-        return tiles[pattern.get_tile()];
+    // Gets a copy of the referred tile, unpacked. No bounds checking!
+    Tile_t get_tile(Pattern_Name const& pattern) const noexcept {
+        return tiles[pattern.get_tile()].unpack();
     }
 
-    // Gets the referred tile. No bounds checking!
-    Tile_t& operator[](Pattern_Name const& pattern) noexcept {
-        return tiles[pattern.get_tile()];
-    }
-
-    // Gets the referred tile. No bounds checking!
-    Tile_t const& operator[](Pattern_Name const& pattern) const noexcept {
-        return tiles[pattern.get_tile()];
+    // Gets a copy of the referred tile, unpacked. No bounds checking!
+    Tile_t operator[](Pattern_Name const& pattern) const noexcept {
+        return tiles[pattern.get_tile()].unpack();
     }
 
     // Appends the tile to VRAM.
-    Pattern_Name push_back(Tile_t const& tile) noexcept {
+    Pattern_Name push_back(Packed_t const& tile) noexcept {
         Pattern_Name pattern(tiles.size());
         tiles.push_back(tile);
         return pattern;
     }
+    Pattern_Name push_back(Tile_t const& tile) noexcept {
+        return push_back(Packed_t(tile));
+    }
 
     // Adds the tile to VRAM, changing its size if needed.
     void add_tile(Tile_t const& tile, Pattern_Name const& pattern) noexcept {
@@ -106,39 +354,150 @@ class VRAM {
         if (index >= tiles.size()) {
             tiles.resize(index + 1);
         }
-        tiles[index] = tile;
+        tiles[index] = Packed_t(tile);
+        invalidate_index();
     }
+    // Result of matching one tile in the batch versions of find_closest.
+    struct Match {
+        Pattern_Name pattern;
+        uint32_t     distance;
+    };
+
     // Finds the pattern name of the tile that most closely resembles the given
     // tile. This resemblance is based on the distance function defined in the
     // tile class. Returns the pattern name as a parameter, and the distance as
     // the function return.
-    uint32_t find_closest(
-            Tile_t const& tile, Pattern_Name& best) const noexcept {
-        // Start with "infinite" distance.
-        uint32_t best_dist = ~0U;
-        auto     start     = tile.begin(NoFlip);
-        auto     finish    = tile.end(NoFlip);
-        // Want to compare using all possible flips.
-        static constexpr std::array<FlipMode, 4> const modes{
-                NoFlip, XFlip, YFlip, XYFlip};
+    // Exact matches, including flipped ones, are found through a hash index.
+    // Otherwise, tiles are tried in order of a lower bound of their distance
+    // to the given tile, stopping once the bound is worse than the best match
+    // so far. Ties are broken in the same way as trying every tile in order
+    // with every flip mode would.
+    uint32_t find_closest(Tile_t const& tile, Pattern_Name& best) const {
+        // Precompute the flipped versions of the tile once for all candidates.
+        TileDistance<Tile_t> const query(distTable, tile);
+        update_index();
+        return search(
+                query, Packed_t(tile), distTable, histograms, 0, tiles.size(),
+                best);
+    }
+    // As above, for every tile in the batch, using up to num_threads threads
+    // (0 means one per core).
+    std::vector<Match> find_closest(
+            std::span<Tile_t const> batch, unsigned num_threads = 0) const {
+        // The index is only read from here on, so the threads can share it.
+        update_index();
+        std::vector<Match> matches(batch.size());
+        parallel_for(batch.size(), num_threads, [&](size_t const ii) {
+            TileDistance<Tile_t> const query(distTable, batch[ii]);
+            matches[ii].distance = search(
+                    query, Packed_t(batch[ii]), distTable, histograms, 0,
+                    tiles.size(), matches[ii].pattern);
+        });
+        return matches;
+    }
 
-        for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-            for (const auto mode : modes) {
-                unsigned dist = it->distance(distTable, mode, start, finish);
-                if (dist < best_dist) {
-                    // Set new best.
-                    best = Pattern_Name(it - tiles.begin());
-                    best.set_flip(mode);
-                    best_dist = dist;
+    // Sets the palette, as 4 lines of 16 colors in the Mega Drive format, for
+    // the versions of find_closest that take palette lines. Colors are then
+    // compared as they would be shown, which lets a tile shown with one line
+    // stand in for a tile meant for another.
+    void set_palette(std::span<uint16_t const, 64> palette) {
+        for (size_t ii = 0; ii < 4; ii++) {
+            for (size_t jj = 0; jj < 4; jj++) {
+                line_tables[ii][jj] = palette_dist_table(
+                        palette.subspan(jj * 16).template first<16>(),
+                        palette.subspan(ii * 16).template first<16>());
+            }
+        }
+        for (auto& line : line_histograms) {
+            line.clear();
+        }
+        has_palette = true;
+    }
+    // Finds the pattern name, palette line included, that shows the tile that
+    // looks most like the given tile shown with the given palette line. Ties
+    // are broken in favor of the line of the tile, then of the lines after it
+    // (wrapping around). The palette must have been set.
+    uint32_t find_closest(
+            Tile_t const& tile, PaletteLine const line,
+            Pattern_Name& best) const {
+        update_index();
+        return search_lines(tile, line, best);
+    }
+    // As above, for every tile in the batch, each with its own palette line,
+    // using up to num_threads threads (0 means one per core).
+    std::vector<Match> find_closest(
+            std::span<Tile_t const> batch, std::span<PaletteLine const> lines,
+            unsigned num_threads = 0) const {
+        update_index();
+        std::vector<Match> matches(batch.size());
+        parallel_for(batch.size(), num_threads, [&](size_t const ii) {
+            matches[ii].distance
+                    = search_lines(batch[ii], lines[ii], matches[ii].pattern);
+        });
+        return matches;
+    }
+    // Finds the closest tile for every tile in the batch, in order, appending
+    // the tile to VRAM whenever the distance is above the threshold; in that
+    // case, the match is the new tile, with distance 0. The result is the same
+    // as calling find_closest and push_back for each tile in turn, but blocks
+    // of tiles are first matched against the existing tiles in parallel, and
+    // only the tiles added within the block are searched serially.
+    std::vector<Match> find_or_add(
+            std::span<Tile_t const> batch, uint32_t threshold = 0,
+            unsigned num_threads = 0) {
+        if (num_threads == 0) {
+            num_threads = default_thread_count();
+        }
+        size_t const       block_size = 64 * static_cast<size_t>(num_threads);
+        std::vector<Match> matches;
+        matches.reserve(batch.size());
+        for (size_t base = 0; base < batch.size(); base += block_size) {
+            auto const block = batch.subspan(
+                    base, std::min(block_size, batch.size() - base));
+            size_t const old_size = tiles.size();
+            for (auto const& match : find_closest(block, num_threads)) {
+                matches.push_back(match);
+            }
+            for (size_t ii = 0; ii < block.size(); ii++) {
+                Match& match = matches[base + ii];
+                if (match.distance != 0 && tiles.size() > old_size) {
+                    // The tiles added in this block come later than the ones
+                    // already searched, so they only win if strictly better.
+                    TileDistance<Tile_t> const query(distTable, block[ii]);
+                    update_index();
+                    Pattern_Name   pattern;
+                    uint32_t const dist = search(
+                            query, Packed_t(block[ii]), distTable, histograms,
+                            old_size, tiles.size(), pattern);
+                    if (dist < match.distance) {
+                        match = {pattern, dist};
+                    }
+                }
+                if (match.distance > threshold) {
+                    match = {push_back(block[ii]), 0};
                 }
             }
         }
-        return best_dist;
+        return matches;
+    }
+    // Converts all tiles to VRAM format, in a single buffer.
+    [[nodiscard]] std::vector<uint8_t> pack() const {
+        std::vector<uint8_t> buffer(tiles.size() * Tile_t::Byte_size);
+        pack(0, tiles.size(), buffer.data());
+        return buffer;
     }
+    // Writes all tiles in VRAM format, a block of them at a time, so that
+    // nothing is allocated.
     void write(std::ostream& output) const noexcept {
-        for (auto it = tiles.begin(); it != tiles.end(); ++it) {
-            auto dest = it->begin(NoFlip);
-            it->draw_tile(output, dest, Tile_t::Num_lines);
+        constexpr size_t const block_size = 128;
+        std::array<uint8_t, block_size * Tile_t::Byte_size> buffer;
+        for (size_t first = 0; first < tiles.size(); first += block_size) {
+            size_t const count = std::min(block_size, tiles.size() - first);
+            pack(first, count, buffer.data());
+            output.write(
+                    static_cast<char const*>(
+                            static_cast<void const*>(buffer.data())),
+                    static_cast<std::streamsize>(count * Tile_t::Byte_size));
         }
     }
 };
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdtools/art_order.hh>
+#include <mdtools/parallel_for.hh>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <tuple>
+#include <utility>
+
+using std::vector;
+
+// Bytes in a tile of art.
+constexpr static size_t const Tile_bytes = 32;
+// How many searches are run, and how many moves each tries per block.
+constexpr static size_t const Search_count    = 8;
+constexpr static size_t const Moves_per_block = 200;
+
+// Tiles [first, last) of a block, used by a frame.
+struct block_use {
+    uint32_t block;
+    uint32_t first;
+    uint32_t last;
+};
+
+// The blocks used by each frame, and the frames that use each block. Blocks
+// are runs of tiles that some pieces need kept together, in order.
+struct block_graph {
+    vector<size_t>            block_start;
+    vector<size_t>            block_size;
+    vector<vector<block_use>> frames;
+    vector<vector<uint32_t>>  users;
+    vector<size_t>            unused;
+    size_t                    max_entries = 0;
+
+    block_graph(mapping_file const& maps, size_t const art_size) {
+        vector<bool> used(art_size);
+        vector<bool> joined(art_size);
+        for (auto const& frame : maps.frames) {
+            for (auto const& piece : frame.maps) {
+                size_t const count = size_t(piece.sx) * size_t(piece.sy);
+                for (size_t ii = piece.tile; ii < piece.tile + count; ii++) {
+                    used[ii] = true;
+                    if (ii + 1 < piece.tile + count) {
+                        joined[ii] = true;
+                    }
+                }
+            }
+        }
+        vector<uint32_t> block_of(art_size);
+        for (size_t ii = 0; ii < art_size; ii++) {
+            if (!used[ii]) {
+                unused.push_back(ii);
+                continue;
+            }
+            if (ii == 0 || !joined[ii - 1]) {
+                block_start.push_back(ii);
+                block_size.push_back(0);
+            }
+            block_of[ii] = static_cast<uint32_t>(block_start.size() - 1);
+            block_size.back()++;
+        }
+
+        users.resize(block_start.size());
+        for (auto const& frame : maps.frames) {
+            // Merges the tiles of the pieces into runs within each block.
+            vector<block_use> uses;
+            for (auto const& piece : frame.maps) {
+                size_t const   count = size_t(piece.sx) * size_t(piece.sy);
+                uint32_t const block = block_of[piece.tile];
+                auto const     first = static_cast<uint32_t>(
+                        piece.tile - block_start[block]);
+                uses.push_back(
+                        {block, first, first + static_cast<uint32_t>(count)});
+            }
+            std::sort(
+                    uses.begin(), uses.end(),
+                    [](auto const& left, auto const& right) {
+                        return std::tie(left.block, left.first)
+                               < std::tie(right.block, right.first);
+                    });
+            vector<block_use> merged;
+            size_t            entries = 0;
+            for (auto const& use : uses) {
+                if (!merged.empty() && merged.back().block == use.block
+                    && merged.back().last >= use.first) {
+                    merged.back().last = std::max(merged.back().last, use.last);
+                } else {
+                    merged.push_back(use);
+                }
+            }
+            for (auto const& use : merged) {
+                entries += (use.last - use.first + 15) / 16;
+                if (users[use.block].empty()
+                    || users[use.block].back() != frames.size()) {
+                    users[use.block].push_back(
+                            static_cast<uint32_t>(frames.size()));
+                }
+            }
+            max_entries = std::max(max_entries, entries);
+            frames.push_back(std::move(merged));
+        }
+    }
+};
+
+// Local search over the order of the blocks. Moves a block next to another
+// one used by the same frame, or anywhere, and keeps the move unless it makes
+// things worse.
+class order_search {
+    block_graph const&                graph;
+    vector<uint32_t>                  order;
+    vector<uint32_t>                  index;
+    vector<size_t>                    start;
+    vector<size_t>                    costs;
+    vector<size_t>                    histogram;
+    art_order::entry_count            count;
+    vector<std::pair<size_t, size_t>> runs;
+    vector<uint32_t>                  stamp;
+    uint32_t                          generation = 0;
+
+    // Updates the position of the blocks in [first, last] of the order.
+    void place(size_t const first, size_t const last) {
+        for (size_t ii = first; ii <= last; ii++) {
+            size_t const block = order[ii];
+            index[block]       = static_cast<uint32_t>(ii);
+            start[block]       = 0;
+            if (ii != 0) {
+                size_t const previous = order[ii - 1];
+                start[block] = start[previous] + graph.block_size[previous];
+            }
+        }
+    }
+
+    // DPLC entries of a frame: consecutive tiles are loaded together, up to
+    // 16 at a time.
+    size_t frame_cost(size_t const frame) {
+        runs.clear();
+        for (auto const& use : graph.frames[frame]) {
+            size_t const base = start[use.block];
+            runs.emplace_back(base + use.first, base + use.last);
+        }
+        std::sort(runs.begin(), runs.end());
+        size_t entries = 0;
+        for (size_t ii = 0; ii < runs.size();) {
+            size_t const first = runs[ii].first;
+            size_t       last  = runs[ii].second;
+            for (ii++; ii < runs.size() && runs[ii].first == last; ii++) {
+                last = runs[ii].second;
+            }
+            entries += (last - first + 15) / 16;
+        }
+        return entries;
+    }
+    // Moves the block at position from to position to.
+    void move(size_t const from, size_t const to) {
+        uint32_t const block = order[from];
+        if (from < to) {
+            std::copy(order.begin() + from + 1, order.begin() + to + 1,
+                      order.begin() + from);
+        } else {
+            std::copy_backward(order.begin() + to, order.begin() + from,
+                               order.begin() + from + 1);
+        }
+        order[to] = block;
+        place(std::min(from, to), std::max(from, to));
+    }
+    void set_cost(size_t const frame, size_t const cost) {
+        histogram[costs[frame]]--;
+        histogram[cost]++;
+        count.total = count.total - costs[frame] + cost;
+        costs[frame] = cost;
+        count.worst  = std::max(count.worst, cost);
+        while (count.worst > 0 && histogram[count.worst] == 0) {
+            count.worst--;
+        }
+    }
+
+public:
+    order_search(block_graph const& graph_, vector<uint32_t> order_)
+            : graph(graph_), order(std::move(order_)),
+              index(order.size()), start(order.size()),
+              costs(graph.frames.size()),
+              histogram(graph.max_entries + 1),
+              stamp(graph.frames.size()) {
+        if (!order.empty()) {
+            place(0, order.size() - 1);
+        }
+        histogram[0] = costs.size();
+        for (size_t ii = 0; ii < costs.size(); ii++) {
+            set_cost(ii, frame_cost(ii));
+        }
+    }
+
+    [[nodiscard]] art_order::entry_count entries() const noexcept {
+        return count;
+    }
+    [[nodiscard]] vector<uint32_t> const& blocks() const noexcept {
+        return order;
+    }
+
+    void run(size_t const moves, uint32_t const seed) {
+        if (order.size() < 2) {
+            return;
+        }
+        std::mt19937     random(seed);
+        vector<uint32_t> affected;
+        vector<size_t>   old_costs;
+        auto const       pick = [&](size_t const limit) {
+            return std::uniform_int_distribution<size_t>(0, limit - 1)(random);
+        };
+        for (size_t move_count = 0; move_count < moves; move_count++) {
+            size_t const block = pick(order.size());
+            size_t const from  = index[block];
+            size_t       to    = pick(order.size());
+            // Usually, the block goes next to another block of a frame that
+            // uses it.
+            if (!graph.users[block].empty() && pick(4) != 0) {
+                auto const& users = graph.users[block];
+                auto const& frame = graph.frames[users[pick(users.size())]];
+                size_t const other = index[frame[pick(frame.size())].block];
+                if (other < from) {
+                    to = other + pick(2);
+                } else if (other > from) {
+                    to = other - pick(2);
+                } else {
+                    continue;
+                }
+            }
+            if (to == from) {
+                continue;
+            }
+
+            // Only the frames that use the blocks whose neighbors change can
+            // change their cost.
+            generation++;
+            affected.clear();
+            auto const touch = [&](size_t const position) {
+                if (position >= order.size()) {
+                    return;
+                }
+                for (auto const frame : graph.users[order[position]]) {
+                    if (stamp[frame] != generation) {
+                        stamp[frame] = generation;
+                        affected.push_back(frame);
+                    }
+                }
+            };
+            for (size_t const position :
+                 {from - 1, from, from + 1, to - 1, to, to + 1}) {
+                touch(position);
+            }
+            art_order::entry_count const old_count = count;
+            move(from, to);
+            old_costs.clear();
+            for (auto const frame : affected) {
+                old_costs.push_back(costs[frame]);
+                set_cost(frame, frame_cost(frame));
+            }
+            if (std::tie(count.total, count.worst)
+                > std::tie(old_count.total, old_count.worst)) {
+                move(to, from);
+                for (size_t ii = 0; ii < affected.size(); ii++) {
+                    set_cost(affected[ii], old_costs[ii]);
+                }
+            }
+        }
+    }
+};
+
+art_order::art_order(
+        mapping_file const& maps, size_t const art_size,
+        unsigned const num_threads) {
+    block_graph const graph(maps, art_size);
+    size_t const      block_count = graph.block_start.size();
+
+    // The art as it is, and the blocks in the order that frames first use
+    // them, are the starting points.
+    vector<uint32_t> identity(block_count);
+    std::iota(identity.begin(), identity.end(), 0U);
+    vector<uint32_t> first_use;
+    vector<bool>     seen(block_count);
+    for (auto const& frame : graph.frames) {
+        for (auto const& use : frame) {
+            if (!seen[use.block]) {
+                seen[use.block] = true;
+                first_use.push_back(use.block);
+            }
+        }
+    }
+
+    vector<order_search> searches;
+    searches.reserve(Search_count);
+    for (size_t ii = 0; ii < Search_count; ii++) {
+        searches.emplace_back(graph, ii == 0 ? identity : first_use);
+    }
+    before = searches.front().entries();
+    parallel_for(searches.size(), num_threads, [&](size_t const ii) {
+        searches[ii].run(
+                Moves_per_block * block_count, static_cast<uint32_t>(ii));
+    });
+    auto const best = std::min_element(
+            searches.cbegin(), searches.cend(),
+            [](auto const& left, auto const& right) {
+                auto const lhs = left.entries();
+                auto const rhs = right.entries();
+                return std::tie(lhs.total, lhs.worst)
+                       < std::tie(rhs.total, rhs.worst);
+            });
+    after = best->entries();
+
+    tiles.reserve(art_size);
+    for (auto const block : best->blocks()) {
+        for (size_t ii = 0; ii < graph.block_size[block]; ii++) {
+            tiles.push_back(graph.block_start[block] + ii);
+        }
+    }
+    tiles.insert(tiles.end(), graph.unused.cbegin(), graph.unused.cend());
+}
+
+void art_order::apply(mapping_file& maps) const {
+    vector<size_t> position(tiles.size());
+    for (size_t ii = 0; ii < tiles.size(); ii++) {
+        position[tiles[ii]] = ii;
+    }
+    for (auto& frame : maps.frames) {
+        for (auto& piece : frame.maps) {
+            piece.tile = static_cast<uint16_t>(position[piece.tile]);
+        }
+    }
+}
+
+vector<uint8_t> art_order::apply(std::span<uint8_t const> art) const {
+    vector<uint8_t> output;
+    output.reserve(art.size());
+    for (auto const tile : tiles) {
+        auto const first
+                = art.begin() + static_cast<ptrdiff_t>(tile * Tile_bytes);
+        output.insert(output.end(), first, first + Tile_bytes);
+    }
+    // Any partial tile at the end stays there.
+    output.insert(
+            output.end(),
+            art.begin() + static_cast<ptrdiff_t>(tiles.size() * Tile_bytes),
+            art.end());
+    return output;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdtools/delta_dplc.hh>
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+using std::vector;
+
+// Tiles [first, last) of the art, which must stay together in VRAM.
+struct tile_run {
+    size_t first;
+    size_t last;
+
+    [[nodiscard]] size_t size() const noexcept {
+        return last - first;
+    }
+    [[nodiscard]] bool contains(tile_run const& other) const noexcept {
+        return first <= other.first && other.last <= last;
+    }
+    [[nodiscard]] bool overlaps(tile_run const& other) const noexcept {
+        return first < other.last && other.first < last;
+    }
+    [[nodiscard]] bool operator<(tile_run const& right) const noexcept {
+        return std::tie(first, last) < std::tie(right.first, right.last);
+    }
+    [[nodiscard]] bool operator==(
+            tile_run const& right) const noexcept = default;
+};
+
+// The tiles of each piece must stay together, and so must those of pieces
+// that share tiles; tiles that are merely next to each other need not.
+static vector<tile_run> frame_runs(frame_mapping const& frame) {
+    vector<tile_run> pieces;
+    pieces.reserve(frame.maps.size());
+    for (auto const& piece : frame.maps) {
+        size_t const count = size_t(piece.sx) * size_t(piece.sy);
+        pieces.push_back({piece.tile, piece.tile + count});
+    }
+    std::sort(pieces.begin(), pieces.end());
+    vector<tile_run> runs;
+    for (auto const& piece : pieces) {
+        if (!runs.empty() && piece.first < runs.back().last) {
+            runs.back().last = std::max(runs.back().last, piece.last);
+        } else {
+            runs.push_back(piece);
+        }
+    }
+    return runs;
+}
+
+// Picks the stable area of one sequence, then adds a frame for each of its
+// frames, and changes it to use them.
+static void add_sequence(
+        mapping_file const& source, size_t const sequence_index,
+        size_t const vram_budget, delta_dplc& output) {
+    vector<size_t>& sequence = output.sequences[sequence_index];
+    // A frame shown again right after itself is not loaded again, so it can
+    // use the same new frame.
+    vector<size_t> frames;
+    vector<size_t> step(sequence.size());
+    for (size_t ii = 0; ii < sequence.size(); ii++) {
+        if (ii == 0 || sequence[ii] != sequence[ii - 1]) {
+            frames.push_back(sequence[ii]);
+        }
+        step[ii] = frames.size() - 1;
+    }
+
+    size_t const             count = frames.size();
+    vector<vector<tile_run>> runs(count);
+    vector<vector<bool>>     stable_use(count);
+    // Tiles each frame loads itself.
+    vector<size_t> loads(count);
+    for (size_t ii = 0; ii < count; ii++) {
+        runs[ii] = frame_runs(source.frames[frames[ii]]);
+        stable_use[ii].resize(runs[ii].size());
+        for (auto const& run : runs[ii]) {
+            loads[ii] += run.size();
+        }
+    }
+    size_t const plain_tiles
+            = std::accumulate(loads.cbegin(), loads.cend(), size_t{0});
+    size_t const peak
+            = count == 0 ? 0 : *std::max_element(loads.cbegin(), loads.cend());
+    size_t const budget = vram_budget != 0 ? vram_budget : peak;
+    if (peak > budget) {
+        output.over_budget.emplace_back(sequence_index, peak);
+    }
+
+    // Runs are tried for the stable area by how many frames they save a load
+    // of, then by size.
+    vector<tile_run> candidates;
+    for (auto const& frame : runs) {
+        candidates.insert(candidates.end(), frame.cbegin(), frame.cend());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(
+            std::unique(candidates.begin(), candidates.end()),
+            candidates.end());
+    vector<size_t> users(candidates.size());
+    for (size_t ii = 0; ii < candidates.size(); ii++) {
+        for (auto const& frame : runs) {
+            users[ii] += std::any_of(
+                    frame.cbegin(), frame.cend(), [&](auto const& run) {
+                        return candidates[ii].contains(run);
+                    });
+        }
+    }
+    vector<size_t> order(candidates.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::stable_sort(
+            order.begin(), order.end(),
+            [&](size_t const left, size_t const right) {
+                return std::tuple(users[left], candidates[left].size())
+                       > std::tuple(users[right], candidates[right].size());
+            });
+
+    vector<tile_run> stable;
+    size_t           stable_size = 0;
+    for (auto const index : order) {
+        auto const& candidate = candidates[index];
+        if (users[index] < 2) {
+            break;
+        }
+        if (std::any_of(stable.cbegin(), stable.cend(), [&](auto const& run) {
+                return run.overlaps(candidate);
+            })) {
+            continue;
+        }
+        vector<size_t> new_loads = loads;
+        for (size_t ii = 0; ii < count; ii++) {
+            for (size_t jj = 0; jj < runs[ii].size(); jj++) {
+                if (!stable_use[ii][jj] && candidate.contains(runs[ii][jj])) {
+                    new_loads[ii] -= runs[ii][jj].size();
+                }
+            }
+        }
+        size_t const new_peak
+                = *std::max_element(new_loads.cbegin(), new_loads.cend());
+        if (new_peak + stable_size + candidate.size() > budget) {
+            continue;
+        }
+        for (size_t ii = 0; ii < count; ii++) {
+            for (size_t jj = 0; jj < runs[ii].size(); jj++) {
+                if (candidate.contains(runs[ii][jj])) {
+                    stable_use[ii][jj] = true;
+                }
+            }
+        }
+        loads = std::move(new_loads);
+        stable.push_back(candidate);
+        stable_size += candidate.size();
+    }
+
+    // The first frame loads everything up to the end of the stable area, so
+    // it can cost more than it saves.
+    size_t base = count == 0 ? 0
+                             : *std::max_element(loads.cbegin(), loads.cend());
+    size_t delta_tiles
+            = std::accumulate(loads.cbegin(), loads.cend(), size_t{0});
+    if (!stable.empty()) {
+        delta_tiles += base + stable_size - loads.front();
+    }
+    if (delta_tiles >= plain_tiles) {
+        stable.clear();
+        stable_size = 0;
+        base        = peak;
+        delta_tiles = plain_tiles;
+        for (auto& frame : stable_use) {
+            std::fill(frame.begin(), frame.end(), false);
+        }
+    }
+    output.tiles_before += plain_tiles;
+    output.tiles_after += delta_tiles;
+    output.vram_tiles = std::max(output.vram_tiles, base + stable_size);
+
+    std::sort(stable.begin(), stable.end());
+    vector<size_t> stable_slot(stable.size());
+    for (size_t ii = 0, slot = base; ii < stable.size(); ii++) {
+        stable_slot[ii] = slot;
+        slot += stable[ii].size();
+    }
+
+    for (size_t ii = 0; ii < count; ii++) {
+        auto const&    frame_run = runs[ii];
+        vector<size_t> run_slot(frame_run.size());
+        frame_dplc     interm;
+        size_t         next = 0;
+        for (size_t jj = 0; jj < frame_run.size(); jj++) {
+            auto const& run = frame_run[jj];
+            if (stable_use[ii][jj]) {
+                auto const where = std::find_if(
+                        stable.cbegin(), stable.cend(),
+                        [&](auto const& elem) {
+                            return elem.contains(run);
+                        });
+                size_t const index = where - stable.cbegin();
+                run_slot[jj] = stable_slot[index] + run.first - where->first;
+                continue;
+            }
+            run_slot[jj] = next;
+            next += run.size();
+            interm.dplc.emplace_back(
+                    static_cast<uint16_t>(run.size()),
+                    static_cast<uint16_t>(run.first));
+        }
+        if (ii == 0 && !stable.empty()) {
+            // The entries are loaded one after the other, so the gap before
+            // the stable area must be filled; tiles that come just before the
+            // stable area in the art need no extra entry.
+            size_t const gap = base - next;
+            if (gap != 0) {
+                size_t const filler = stable.front().first >= gap
+                                              ? stable.front().first - gap
+                                              : 0;
+                interm.dplc.emplace_back(
+                        static_cast<uint16_t>(gap),
+                        static_cast<uint16_t>(filler));
+            }
+            for (auto const& run : stable) {
+                interm.dplc.emplace_back(
+                        static_cast<uint16_t>(run.size()),
+                        static_cast<uint16_t>(run.first));
+            }
+        }
+
+        frame_mapping maps = source.frames[frames[ii]];
+        for (auto& piece : maps.maps) {
+            // Last run that starts at or before the piece.
+            auto const where = std::upper_bound(
+                                       frame_run.cbegin(), frame_run.cend(),
+                                       piece.tile,
+                                       [](size_t const tile, auto const& run) {
+                                           return tile < run.first;
+                                       })
+                               - 1;
+            size_t const index = where - frame_run.cbegin();
+            piece.tile         = static_cast<uint16_t>(
+                    run_slot[index] + piece.tile - where->first);
+        }
+        output.maps.frames.push_back(std::move(maps));
+        output.dplc.frames.push_back(interm.consolidate());
+    }
+    size_t const first_frame = output.maps.frames.size() - count;
+    for (size_t ii = 0; ii < sequence.size(); ii++) {
+        sequence[ii] = first_frame + step[ii];
+    }
+}
+
+delta_dplc::delta_dplc(
+        mapping_file const& source, vector<vector<size_t>> const& sequences_,
+        size_t const vram_budget)
+        : sequences(sequences_) {
+    dplc = maps.split(source);
+    for (size_t ii = 0; ii < sequences.size(); ii++) {
+        add_sequence(source, ii, vram_budget, *this);
+    }
+}
@@ -17,6 +17,7 @@
 
 #include <mdcomp/bigendian_io.hh>
 #include <mdtools/dplcfile.hh>
+#include <mdtools/frame_dedup.hh>
 
 #ifdef __GNUG__
 #    pragma GCC diagnostic push
@@ -35,7 +36,6 @@
 
 using std::ios;
 using std::istream;
-using std::map;
 using std::ostream;
 using std::vector;
 
@@ -66,38 +66,12 @@ dplc_file::dplc_file(istream& input, int const version) {
     }
 }
 
-void dplc_file::write(
-        ostream& output, int const version, bool const null_first) const {
-    map<frame_dplc, size_t> map_to_pos;
-    map<size_t, frame_dplc> pos_to_map;
-
-    size_t size = 2 * frames.size();
-
-    if (null_first && version != 4 && !frames.empty()
-        && frames.front().dplc.empty()) {
-        map_to_pos.emplace(frames.front(), 0);
-        pos_to_map.emplace(0, frames.front());
-    }
-    for (auto const& frame : frames) {
-        if (auto const found = map_to_pos.find(frame);
-            found != map_to_pos.end()) {
-            BigEndian::Write2(output, found->second);
-        } else {
-            map_to_pos.emplace(frame, size);
-            pos_to_map.emplace(size, frame);
-            BigEndian::Write2(output, size);
-            size += frame.size(version);
-        }
-    }
-    for (auto const& [position, dplc] : pos_to_map) {
-        auto const fpos = static_cast<size_t>(output.tellp());
-        if (position == fpos) {
-            dplc.write(output, version);
-        } else if (position != 0U) {
-            fmt::print(stderr, "Missed write at {}\n", fpos);
-            dplc.print();
-        }
-    }
+size_t dplc_file::write(
+        ostream& output, int const version, bool const null_first,
+        bool const share_tails) const {
+    bool const null_frame = null_first && version != 4 && !frames.empty()
+                            && frames.front().dplc.empty();
+    return write_frames(output, frames, version, null_frame, share_tails);
 }
 
 void dplc_file::print() const {
@@ -16,6 +16,7 @@
  */
 
 #include <mdcomp/bigendian_io.hh>
+#include <mdtools/frame_dedup.hh>
 #include <mdtools/framedplc.hh>
 
 #ifdef __GNUG__
@@ -126,3 +127,11 @@ std::map<size_t, size_t> frame_dplc::build_vram_map() const {
     }
     return vram_map;
 }
+
+uint64_t frame_dplc::hash() const noexcept {
+    uint64_t hash = dplc.size();
+    for (auto const& elem : dplc) {
+        hash = hash_combine(hash, (unsigned(elem.count) << 16U) | elem.tile);
+    }
+    return hash;
+}
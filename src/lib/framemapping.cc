@@ -16,6 +16,7 @@
  */
 
 #include <mdcomp/bigendian_io.hh>
+#include <mdtools/frame_dedup.hh>
 #include <mdtools/framemapping.hh>
 #include <mdtools/ignore_unused_variable_warning.hh>
 
@@ -135,3 +136,16 @@ void frame_mapping::change_pal(
         elem.change_pal(source_palette, dest_palette);
     }
 }
+
+uint64_t frame_mapping::hash() const noexcept {
+    uint64_t hash = maps.size();
+    for (auto const& elem : maps) {
+        uint64_t const pattern
+                = (uint64_t(elem.flags) << 16U) | uint64_t(elem.tile);
+        uint64_t const position
+                = (uint64_t(uint16_t(elem.xx)) << 16U) | uint16_t(elem.yy);
+        hash = hash_combine(hash, (pattern << 32U) | position);
+        hash = hash_combine(hash, (unsigned(elem.sx) << 8U) | elem.sy);
+    }
+    return hash;
+}
@@ -16,6 +16,7 @@
  */
 
 #include <mdcomp/bigendian_io.hh>
+#include <mdtools/frame_dedup.hh>
 #include <mdtools/mappingfile.hh>
 
 #ifdef __GNUG__
@@ -31,12 +32,10 @@
 
 #include <cstdint>
 #include <iostream>
-#include <map>
 #include <numeric>
 
 using std::ios;
 using std::istream;
-using std::map;
 using std::ostream;
 using std::vector;
 
@@ -65,36 +64,12 @@ mapping_file::mapping_file(istream& input, int const version) {
     }
 }
 
-void mapping_file::write(
-        ostream& output, int const version, bool const null_first) const {
-    map<frame_mapping, size_t> map_to_pos;
-    map<size_t, frame_mapping> pos_to_map;
-    size_t                     size = 2 * frames.size();
-
-    if (null_first && !frames.empty() && frames.front().maps.empty()) {
-        map_to_pos.emplace(frames.front(), 0);
-        pos_to_map.emplace(0, frames.front());
-    }
-    for (auto const& frame : frames) {
-        if (auto const found = map_to_pos.find(frame);
-            found != map_to_pos.end()) {
-            BigEndian::Write2(output, found->second);
-        } else {
-            map_to_pos.emplace(frame, size);
-            pos_to_map.emplace(size, frame);
-            BigEndian::Write2(output, size);
-            size += frame.size(version);
-        }
-    }
-    for (auto const& [pos, maps] : pos_to_map) {
-        auto const fpos = static_cast<size_t>(output.tellp());
-        if (pos == fpos) {
-            maps.write(output, version);
-        } else if (pos != 0U) {
-            fmt::print(stderr, "Missed write at {}\n", fpos);
-            maps.print();
-        }
-    }
+size_t mapping_file::write(
+        ostream& output, int const version, bool const null_first,
+        bool const share_tails) const {
+    bool const null_frame = null_first && !frames.empty()
+                            && frames.front().maps.empty();
+    return write_frames(output, frames, version, null_frame, share_tails);
 }
 
 void mapping_file::print() const {
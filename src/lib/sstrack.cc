@@ -16,142 +16,625 @@
  */
 
 #include <mdcomp/bigendian_io.hh>
-#include <mdcomp/bitstream.hh>
 #include <mdtools/sstrack.hh>
 
-#include <iterator>
-#include <sstream>
-#include <string>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <utility>
+#include <vector>
 
-using std::ios;
 using std::istream;
-using std::ostream_iterator;
-using std::stringstream;
+using std::span;
 using std::vector;
 
-SSTrackFrame::SSTrackFrame(istream& input, bool const xflip) noexcept {
-    stringstream bit_flags(ios::in | ios::out | ios::binary);
-    stringstream sym_maps(ios::in | ios::out | ios::binary);
-    stringstream dic_maps(ios::in | ios::out | ios::binary);
-    // Fill in the bit_flags stream.
-    size_t position = input.tellg();
-    input.ignore(2);
-    uint16_t const            len1 = BigEndian::Read2(input);
-    ostream_iterator<uint8_t> bfdst(bit_flags);
-    for (uint16_t ii = 0; ii < len1; ii++) {
-        *bfdst++ = Read1(input);
-    }
-    bit_flags.seekg(0);
-
-    // Fill in the symbolwise index stream.
-    input.seekg(position + len1 + 4);
-    position = input.tellg();
-    input.ignore(2);
-    uint16_t const            len2 = BigEndian::Read2(input);
-    ostream_iterator<uint8_t> smdst(sym_maps);
-    for (uint16_t ii = 0; ii < len2; ii++) {
-        *smdst++ = Read1(input);
-    }
-    sym_maps.seekg(0);
-
-    // Fill in the dictionary index stream.
-    input.seekg(position + len2 + 4);
-    input.ignore(2);
-    uint16_t const len3 = BigEndian::Read2(input);
-
-    ostream_iterator<uint8_t> dmdst(dic_maps);
-    for (uint16_t ii = 0; ii < len3; ii++) {
-        *dmdst++ = Read1(input);
-    }
-    dic_maps.seekg(0);
-
-    ibitstream<uint8_t, false>  ibitflags(bit_flags);
-    ibitstream<uint16_t, false> isym_maps(sym_maps);
-    ibitstream<uint8_t, false>  idic_maps(dic_maps);
-
-    auto* lineit   = getTable().begin();
-    Line* cur_line = &(*lineit);
-    // Only one of these get used depending on xflip.
-    auto* fwdit = cur_line->begin();
-    auto  revit = cur_line->rbegin();
-
-    while (lineit != getTable().end()) {
+// Reads bits, most significant first, from the big-endian words of type T in a
+// byte span. Works like ibitstream<T, false>: a new word is only loaded once a
+// bit from it is needed. Reading past the end of the span gives bits set to 1,
+// as reading from a stream that is at its end would.
+template <typename T>
+class span_ibitstream {
+    static constexpr uint32_t const Word_bits = sizeof(T) * CHAR_BIT;
+
+    span<uint8_t const> data;
+    size_t              position  = 0;
+    uint32_t            bitbuffer = 0;
+    uint32_t            readbits  = 0;
+
+    uint8_t byte_at(size_t const index) const noexcept {
+        return index < data.size() ? data[index] : 0xffU;
+    }
+    uint32_t read_word() noexcept {
+        uint32_t value = 0;
+        for (size_t ii = 0; ii < sizeof(T); ii++) {
+            value = (value << 8U) | byte_at(position++);
+        }
+        return value;
+    }
+    void check_buffer() noexcept {
+        if (readbits == 0) {
+            bitbuffer = read_word();
+            readbits  = Word_bits;
+        }
+    }
+
+public:
+    explicit span_ibitstream(span<uint8_t const> data_) noexcept
+            : data(data_), readbits(Word_bits) {
+        bitbuffer = read_word();
+    }
+
+    bool pop() noexcept {
+        check_buffer();
+        readbits--;
+        return ((bitbuffer >> readbits) & 1U) != 0;
+    }
+    // Reads count bits; count must be at most the number of bits in a word.
+    uint32_t read(uint32_t const count) noexcept {
+        check_buffer();
+        if (readbits >= count) {
+            readbits -= count;
+            return (bitbuffer >> readbits) & ((1U << count) - 1U);
+        }
+        uint32_t const rest = count - readbits;
+        uint32_t const bits = bitbuffer & ((1U << readbits) - 1U);
+        bitbuffer           = read_word();
+        readbits            = Word_bits - rest;
+        return (bits << rest) | ((bitbuffer >> readbits) & ((1U << rest) - 1U));
+    }
+    [[nodiscard]] uint32_t have_waiting_bits() const noexcept {
+        return readbits;
+    }
+    // The byte after the last word loaded, or 0xff if there are no more.
+    [[nodiscard]] uint8_t peek() const noexcept {
+        return byte_at(position);
+    }
+    void ignore() noexcept {
+        position++;
+    }
+};
+
+// Reads the three segments of a track frame from the stream into a buffer,
+// stopping early if the stream ends.
+static vector<uint8_t> read_segments(istream& input) {
+    vector<uint8_t> buffer;
+    auto const      read = [&](size_t const count) {
+        size_t const start = buffer.size();
+        buffer.resize(start + count);
+        input.read(
+                static_cast<char*>(static_cast<void*>(buffer.data() + start)),
+                static_cast<std::streamsize>(count));
+        buffer.resize(start + static_cast<size_t>(input.gcount()));
+        return input.good();
+    };
+    for (size_t ii = 0; ii < 3; ii++) {
+        if (!read(4)) {
+            break;
+        }
+        size_t const length = (size_t(buffer[buffer.size() - 2]) << 8U)
+                              | buffer.back();
+        if (!read(length)) {
+            break;
+        }
+    }
+    return buffer;
+}
+
+SSTrackFrame::SSTrackFrame(
+        istream& input, bool const xflip, TrackDecoder const decoder,
+        SSTrackTables const& tables) noexcept
+        : SSTrackFrame(read_segments(input), xflip, decoder, tables) {}
+
+// The data is made of three segments (bit flags, symbolwise indices and
+// dictionary indices), each with a 2-byte word that is ignored, a 2-byte length
+// and then its contents. Returns false if the data is too short.
+bool SSTrackFrame::split_segments(
+        span<uint8_t const> input, Segments& segments) noexcept {
+    for (auto& segment : segments) {
+        if (input.size() < 4) {
+            return false;
+        }
+        size_t const length = (size_t(input[2]) << 8U) | input[3];
+        if (input.size() - 4 < length) {
+            return false;
+        }
+        segment = input.subspan(4, length);
+        input   = input.subspan(4 + length);
+    }
+    return true;
+}
+
+// Decodes the frame in place; makes no allocations.
+SSTrackFrame::SSTrackFrame(
+        span<uint8_t const> input, bool const xflip, TrackDecoder const decoder,
+        SSTrackTables const& tables) noexcept {
+    Segments segments;
+    if (!split_segments(input, segments)) {
+        return;
+    }
+    if (decoder == TrackDecoder::Table) {
+        valid = decode_table(segments, xflip, tables);
+    } else {
+        valid = decode_bitwise(segments, xflip, tables, nullptr);
+    }
+}
+
+SSTrackFrame::SSTrackFrame(
+        span<uint8_t const> input, bool const xflip, SSTrackStats& stats,
+        SSTrackTables const& tables) noexcept {
+    stats = SSTrackStats();
+    Segments segments;
+    if (!split_segments(input, segments)) {
+        return;
+    }
+    valid = decode_bitwise(segments, xflip, tables, &stats);
+}
+
+// Decodes one entry at a time, reading the bits in the same way as the game.
+bool SSTrackFrame::decode_bitwise(
+        Segments const& segments, bool const xflip, SSTrackTables const& tables,
+        SSTrackStats* const stats) noexcept {
+    span_ibitstream<uint8_t>  bit_flags(segments[0]);
+    span_ibitstream<uint16_t> sym_maps(segments[1]);
+    span_ibitstream<uint8_t>  dic_maps(segments[2]);
+
+    auto&        table    = getTable();
+    size_t       cur_line = 0;
+    size_t       used     = 0;
+    size_t const width    = Width;
+    // Only one of the ends of the line gets used depending on xflip.
+    auto const put = [&](Pattern_Name const pattern) {
+        table[cur_line][xflip ? width - 1 - used : used] = pattern;
+        used++;
+    };
+    // Counts for the current line, if they are wanted.
+    SSTrackLineStats* line_stats
+            = stats != nullptr ? stats->lines.data() : nullptr;
+    auto const next_line = [&](bool const aligned) {
+        if (line_stats != nullptr) {
+            line_stats->line_ends++;
+            line_stats->aligned_ends += aligned ? 1 : 0;
+            line_stats->dic_bits += aligned ? 0 : 8;
+            line_stats++;
+        }
+        cur_line++;
+        used = 0;
+    };
+
+    while (cur_line < table.size()) {
+        if (line_stats != nullptr) {
+            line_stats->flag_bits++;
+        }
         // Is the next entry symbolwise- or dictionary-encoded?
-        if (ibitflags.pop() != 0) {
+        if (bit_flags.pop()) {
             // Symbolwise.
             Pattern_Name pattern;
             // 10-bit index or 6-bit index?
-            if (isym_maps.pop() != 0) {
+            if (sym_maps.pop()) {
                 // 10-bit.
-                pattern = SymLUT_10bit[isym_maps.read(10)];
+                uint32_t const index = sym_maps.read(10);
+                if (index >= tables.sym_10bit_size) {
+                    return false;
+                }
+                pattern = tables.sym_10bit[index];
+                if (line_stats != nullptr) {
+                    line_stats->sym_bits += 11;
+                    line_stats->sym_10bit++;
+                }
             } else {
                 // 6-bit.
-                pattern = SymLUT_6bit[isym_maps.read(6)];
+                pattern = tables.sym_6bit[sym_maps.read(6)];
+                if (line_stats != nullptr) {
+                    line_stats->sym_bits += 7;
+                    line_stats->sym_6bit++;
+                }
+            }
+            if (used == width) {
+                return false;
             }
             // Set correct palette.
             pattern.set_palette(Line3);
             if (xflip) {
-                // Flip the pattern name and put it from the end of line.
+                // Flip the pattern name; it goes from the end of line.
                 pattern.set_flip(pattern.get_flip() ^ XFlip);
-                *revit++ = pattern;
-            } else {
-                // Just write the pattern name.
-                *fwdit++ = pattern;
             }
+            put(pattern);
         } else {
             // Dictionary.
             // Do he have zero bits in the buffer?
-            if (idic_maps.have_waiting_bits() == 0U) {
+            if (dic_maps.have_waiting_bits() == 0U) {
                 // Yes; check to see if the next byte is a 0xff.
-                if (static_cast<uint8_t>(dic_maps.peek()) == 0xff) {
+                if (dic_maps.peek() == 0xff) {
                     // It is. Discard byte, advance to next line and continue.
-                    dic_maps.ignore(1);
-                    ++lineit;
-                    cur_line = &(*lineit);
-                    fwdit    = cur_line->begin();
-                    revit    = cur_line->rbegin();
+                    dic_maps.ignore();
+                    next_line(true);
                     continue;
                 }
             }
             RLEPattern pattern;
             // 7-bit index or 6-bit index?
-            if (idic_maps.pop() != 0) {
+            if (dic_maps.pop()) {
                 // 7-bit.
-                uint8_t const value = idic_maps.read(7);
+                uint32_t const value = dic_maps.read(7);
                 // Did we read a 0x7f?
                 if (value == 0x7f) {
                     // Yes; this means a non-byte-aligned 0xff, or end-of-line.
                     // Advance to next line and continue.
-                    ++lineit;
-                    cur_line = &(*lineit);
-                    fwdit    = cur_line->begin();
-                    revit    = cur_line->rbegin();
+                    next_line(false);
                     continue;
                 }
-                pattern = DicLUT_7bit[value];
+                if (value >= tables.dic_7bit_size) {
+                    return false;
+                }
+                pattern = tables.dic_7bit[value];
+                if (line_stats != nullptr) {
+                    line_stats->dic_bits += 8;
+                    line_stats->dic_7bit++;
+                }
             } else {
-                pattern = DicLUT_6bit[idic_maps.read(6)];
+                pattern = tables.dic_6bit[dic_maps.read(6)];
+                if (line_stats != nullptr) {
+                    line_stats->dic_bits += 7;
+                    line_stats->dic_6bit++;
+                }
+            }
+            if (width - used <= pattern.second) {
+                return false;
+            }
+            if (line_stats != nullptr) {
+                line_stats->run_entries += pattern.second + 1;
+                line_stats->longest_run = std::max(
+                        line_stats->longest_run, pattern.second + 1);
             }
             // Set correct palette and priority.
             pattern.first.set_palette(Line3);
             pattern.first.set_priority(true);
             // Write the pattern name as many times as needed.
+            for (unsigned ii = 0; ii <= pattern.second; ii++) {
+                put(pattern.first);
+            }
+        }
+    }
+    return true;
+}
+
+// Bits of a byte span, most significant first, read through a window of at
+// least 32 bits. Bits past the end of the span read as 1, as in
+// span_ibitstream.
+class span_bitwindow {
+    span<uint8_t const> data;
+    size_t              next   = 0;
+    uint64_t            buffer = 0;
+    uint32_t            count  = 0;
+
+    // Tops up the buffer to at least 57 bits. Away from the end of the data,
+    // this is done with a single 8-byte load, keeping the whole bytes that fit.
+    void refill() noexcept {
+        if (next + sizeof(buffer) <= data.size()) {
+            uint64_t word = 0;
+            for (size_t ii = 0; ii < sizeof(word); ii++) {
+                word = (word << 8U) | data[next + ii];
+            }
+            buffer |= word >> count;
+            uint32_t const loaded = (63U - count) / 8U;
+            next += loaded;
+            count += loaded * 8U;
+            return;
+        }
+        while (count <= 56) {
+            uint64_t const byte = next < data.size() ? data[next] : 0xffU;
+            buffer |= byte << (56U - count);
+            next++;
+            count += 8;
+        }
+    }
+
+public:
+    explicit span_bitwindow(span<uint8_t const> data_) noexcept
+            : data(data_) {
+        refill();
+    }
+
+    // The next count bits, with 0 < count <= 32.
+    [[nodiscard]] uint32_t peek(uint32_t const count_) const noexcept {
+        return static_cast<uint32_t>(buffer >> (64U - count_));
+    }
+    // Skips count bits, with count <= 32.
+    void skip(uint32_t const count_) noexcept {
+        buffer <<= count_;
+        count -= count_;
+        if (count < 32) {
+            refill();
+        }
+    }
+};
+
+// Decodes whole entries with one lookup each, using the tables of entries
+// indexed by the next bits of the symbolwise and dictionary streams, and takes
+// each run of symbolwise entries from the bit flags at once. The length of each
+// entry only depends on its first bit, so it is known before the lookup is
+// done. The result is the same as with decode_bitwise, which the tables are
+// built to match: for instance, a byte-aligned 0xff in the dictionary stream
+// reads as the 0x7f end of line.
+bool SSTrackFrame::decode_table(
+        Segments const& segments, bool const xflip,
+        SSTrackTables const& tables) noexcept {
+    using SymEntry = SSTrackTables::SymEntry;
+    using DicEntry = SSTrackTables::DicEntry;
+    constexpr static uint32_t const Sym_bits = SSTrackTables::Sym_bits;
+    constexpr static uint32_t const Dic_bits = SSTrackTables::Dic_bits;
+
+    SSTrackTables::SymTable const& sym_table
+            = tables.sym_entries[xflip ? 1 : 0];
+    SSTrackTables::DicTable const& dic_table = tables.dic_entries;
+
+    span_bitwindow bit_flags(segments[0]);
+    span_bitwindow sym_maps(segments[1]);
+    span_bitwindow dic_maps(segments[2]);
+
+    auto&        table = getTable();
+    size_t const width = Width;
+    for (auto& line : table) {
+        // Only one of the ends of the line gets used depending on xflip.
+        size_t used = 0;
+        auto const index = [&](size_t const count) {
+            return static_cast<ptrdiff_t>(xflip ? width - used - count : used);
+        };
+        while (true) {
+            // Run of symbolwise entries, possibly followed by a dictionary one.
+            uint32_t const flags = bit_flags.peek(32);
+            auto const     run = static_cast<uint32_t>(std::countl_one(flags));
+            if (run > width - used) {
+                return false;
+            }
+            for (uint32_t ii = 0; ii < run; ii++) {
+                uint32_t const  window = sym_maps.peek(Sym_bits);
+                SymEntry const& entry  = sym_table[window];
+                sym_maps.skip(7U + ((window >> 8U) & 4U));
+                if (!entry.valid) {
+                    return false;
+                }
+                line[index(1)] = entry.pattern;
+                used++;
+            }
+            bit_flags.skip(run);
+            if (run == 32) {
+                continue;
+            }
+            bit_flags.skip(1);
+            uint32_t const  window = dic_maps.peek(Dic_bits);
+            DicEntry const& entry  = dic_table[window];
+            dic_maps.skip(7U + (window >> 7U));
+            if (!entry.valid) {
+                return false;
+            }
+            if (entry.count == 0) {
+                break;
+            }
+            if (entry.count > width - used) {
+                return false;
+            }
+            std::fill_n(line.begin() + index(entry.count), entry.count,
+                        entry.pattern);
+            used += entry.count;
+        }
+    }
+    return true;
+}
+
+// Writes bits, most significant first, into a buffer of big-endian words of
+// type T. The last word is padded with clear bits.
+template <typename T>
+class vector_obitstream {
+    vector<uint8_t>& data;
+    uint32_t         bitbuffer = 0;
+    uint32_t         count     = 0;
+
+public:
+    explicit vector_obitstream(vector<uint8_t>& data_) noexcept
+            : data(data_) {}
+
+    // Writes the low count_ bits of bits; count_ must be at most 24.
+    void write(uint32_t const bits, uint32_t const count_) noexcept {
+        bitbuffer = (bitbuffer << count_) | bits;
+        count += count_;
+        while (count >= 8) {
+            count -= 8;
+            data.push_back(static_cast<uint8_t>(bitbuffer >> count));
+        }
+        bitbuffer &= (1U << count) - 1U;
+    }
+    void flush() noexcept {
+        if (count != 0) {
+            data.push_back(static_cast<uint8_t>(bitbuffer << (8U - count)));
+            count = 0;
+        }
+        while (data.size() % sizeof(T) != 0) {
+            data.push_back(0);
+        }
+    }
+};
+
+// Pattern names that the decoder can give, which are on palette line 3, are
+// told apart by their tile, flip and priority. Those on other lines get a key
+// of their own that no code has.
+static uint32_t track_key(Pattern_Name const pattern) noexcept {
+    if (pattern.get_palette() != Line3) {
+        return SSTrackEncoder::Key_count;
+    }
+    return pattern.get_tile() | (uint32_t(pattern.get_flip()) << 11U)
+           | (uint32_t(pattern.high_priority()) << 13U);
+}
+static bool is_blank(Pattern_Name const pattern) noexcept {
+    return pattern.get_tile() == 0 && pattern.get_flip() == NoFlip
+           && pattern.get_palette() == Line0 && !pattern.high_priority();
+}
+
+SSTrackEncoder::SSTrackEncoder(SSTrackTables const& tables)
+        : sym_codes(Key_count + 1) {
+    // Shortest symbolwise code of each pattern name, if any. The tables give
+    // pattern names on any palette line, and the decoder moves them to line 3.
+    auto const table_key = [](Pattern_Name pattern) {
+        pattern.set_palette(Line3);
+        return track_key(pattern);
+    };
+    for (size_t ii = tables.sym_10bit_size; ii-- > 0;) {
+        sym_codes[table_key(tables.sym_10bit[ii])]
+                = {static_cast<uint16_t>(0x400U | ii), 11, 1, false};
+    }
+    for (size_t ii = tables.sym_6bit.size(); ii-- > 0;) {
+        sym_codes[table_key(tables.sym_6bit[ii])]
+                = {static_cast<uint16_t>(ii), 7, 1, false};
+    }
+    // Dictionary codes of each pattern name, which the decoder also gives
+    // high priority.
+    auto const add_dic = [&](RLEPattern pattern, size_t const code,
+                             uint8_t const bits) {
+        if (pattern.second >= PlaneH128V28::Width) {
+            return;
+        }
+        pattern.first.set_priority(true);
+        dic_codes.emplace_back(
+                table_key(pattern.first),
+                Code{static_cast<uint16_t>(code), bits,
+                     static_cast<uint8_t>(pattern.second + 1), true});
+    };
+    for (size_t ii = 0; ii < tables.dic_6bit.size(); ii++) {
+        add_dic(tables.dic_6bit[ii], ii, 7);
+    }
+    for (size_t ii = 0; ii < tables.dic_7bit_size; ii++) {
+        add_dic(tables.dic_7bit[ii], 0x80U | ii, 8);
+    }
+    std::stable_sort(
+            dic_codes.begin(), dic_codes.end(),
+            [](auto const& left, auto const& right) {
+                return left.first < right.first;
+            });
+}
+
+// Each entry costs a bit flag and its code, and each line ends with a bit flag
+// and the 8-bit end of line code. The cheapest encoding of each line is found
+// from its end backwards: the cost from each entry on is the cheapest, over the
+// codes that can start there, of the code plus the cost after it. The bit
+// flags, symbolwise and dictionary indices go to separate streams, so their
+// bits are all counted alike.
+bool SSTrackEncoder::encode(
+        PlaneH128V28 const& plane, std::ostream& output,
+        bool const xflip) const {
+    constexpr static size_t const Width  = PlaneH128V28::Width;
+    constexpr static size_t const Height = PlaneH128V28::Height;
+
+    constexpr static uint32_t const Unreachable = UINT32_MAX;
+    constexpr static uint32_t const End_bits    = 1 + 8;
+
+    std::array<vector<uint8_t>, 3> buffers;
+    vector_obitstream<uint8_t>     bit_flags(buffers[0]);
+    vector_obitstream<uint16_t>    sym_maps(buffers[1]);
+    vector_obitstream<uint8_t>     dic_maps(buffers[2]);
+
+    std::array<uint32_t, Width + 1>  sym_keys{};
+    std::array<uint32_t, Width + 1>  dic_keys{};
+    std::array<size_t, Width + 1>    run{};
+    std::array<uint32_t, Width + 1>  cost{};
+    std::array<Code, Width + 1>      choice{};
+    for (size_t line = 0; line < Height; line++) {
+        // The entries of the line, in the order they are decoded, up to the
+        // blank ones at the end.
+        size_t length = 0;
+        for (size_t ii = 0; ii < Width; ii++) {
+            Pattern_Name pattern = plane[line][xflip ? Width - 1 - ii : ii];
+            if (!is_blank(pattern)) {
+                length = ii + 1;
+            }
+            dic_keys[ii] = track_key(pattern);
+            // The decoder flips symbolwise entries, but not dictionary ones.
             if (xflip) {
-                for (unsigned ii = 0; ii <= pattern.second; ii++) {
-                    *revit++ = pattern.first;
+                pattern.set_flip(pattern.get_flip() ^ XFlip);
+            }
+            sym_keys[ii] = track_key(pattern);
+        }
+        run[length]  = 0;
+        cost[length] = End_bits;
+        for (size_t ii = length; ii-- > 0;) {
+            uint32_t const key = dic_keys[ii];
+            run[ii]  = ii + 1 < length && dic_keys[ii + 1] == key
+                               ? run[ii + 1] + 1
+                               : 1;
+            cost[ii] = Unreachable;
+            Code const& sym = sym_codes[sym_keys[ii]];
+            if (sym.bits != 0 && cost[ii + 1] != Unreachable) {
+                cost[ii]   = 1 + sym.bits + cost[ii + 1];
+                choice[ii] = sym;
+            }
+            auto entry = std::lower_bound(
+                    dic_codes.cbegin(), dic_codes.cend(), key,
+                    [](auto const& code, uint32_t const value) {
+                        return code.first < value;
+                    });
+            for (; entry != dic_codes.cend() && entry->first == key; ++entry) {
+                Code const& dic = entry->second;
+                if (dic.length > run[ii]
+                    || cost[ii + dic.length] == Unreachable) {
+                    continue;
                 }
-            } else {
-                for (unsigned ii = 0; ii <= pattern.second; ii++) {
-                    *fwdit++ = pattern.first;
+                uint32_t const total = 1 + dic.bits + cost[ii + dic.length];
+                if (total < cost[ii]) {
+                    cost[ii]   = total;
+                    choice[ii] = dic;
                 }
             }
         }
+        if (cost[0] == Unreachable) {
+            return false;
+        }
+        for (size_t ii = 0; ii < length; ii += choice[ii].length) {
+            Code const& code = choice[ii];
+            if (code.dictionary) {
+                bit_flags.write(0, 1);
+                dic_maps.write(code.code, code.bits);
+            } else {
+                bit_flags.write(1, 1);
+                sym_maps.write(code.code, code.bits);
+            }
+        }
+        bit_flags.write(0, 1);
+        dic_maps.write(0xff, 8);
+    }
+    bit_flags.flush();
+    sym_maps.flush();
+    dic_maps.flush();
+
+    // Each segment has a 32-bit length, of which the decoder only reads the
+    // low 16 bits.
+    for (auto const& buffer : buffers) {
+        if (buffer.size() > 0xffffU) {
+            return false;
+        }
     }
+    for (auto const& buffer : buffers) {
+        BigEndian::Write4(output, static_cast<uint32_t>(buffer.size()));
+        output.write(
+                static_cast<char const*>(static_cast<void const*>(
+                        buffer.data())),
+                static_cast<std::streamsize>(buffer.size()));
+    }
+    return true;
+}
+
+bool SSTrackFrame::encode(
+        PlaneH128V28 const& plane, std::ostream& output, bool const xflip,
+        SSTrackTables const& tables) {
+    return SSTrackEncoder(tables).encode(plane, output, xflip);
 }
 
-// Hard-coded stuff starts here.
-// At some point, we will want to use the raw game data instead of hard-coding
-// all of this.
+// The tables of the game, built at compile time. Hacks that changed them can
+// use SSTrackTables::load instead.
 constexpr static inline Pattern_Name make_block_tile(
         uint16_t address, uint16_t flip_x, uint16_t flip_y, uint16_t palette,
         uint16_t priority) {
@@ -163,7 +646,8 @@ constexpr static inline Pattern_Name make_block_tile(
             | ((static_cast<unsigned>(address)) & 0x7FFU));
 }
 
-vector<Pattern_Name> SSTrackFrame::SymLUT_6bit{
+constexpr static std::array<Pattern_Name, SSTrackTables::Sym_6bit_size> const
+        SymLUT_6bit{
         make_block_tile(0x0001, 0, 0, 0, 1),
         make_block_tile(0x0007, 0, 0, 0, 1),
         make_block_tile(0x002C, 0, 0, 0, 1),
@@ -229,7 +713,8 @@ vector<Pattern_Name> SSTrackFrame::SymLUT_6bit{
         make_block_tile(0x0019, 0, 0, 0, 1),
         make_block_tile(0x0052, 0, 0, 0, 1)};
 
-vector<Pattern_Name> SSTrackFrame::SymLUT_10bit{
+constexpr static std::array<Pattern_Name, SSTrackTables::Sym_10bit_size> const
+        SymLUT_10bit{
         make_block_tile(0x0009, 0, 0, 0, 1),
         make_block_tile(0x005A, 0, 0, 0, 1),
         make_block_tile(0x0030, 1, 0, 0, 1),
@@ -779,7 +1264,8 @@ vector<Pattern_Name> SSTrackFrame::SymLUT_10bit{
         make_block_tile(0x0167, 1, 0, 0, 1),
         make_block_tile(0x00A1, 1, 0, 0, 1)};
 
-vector<RLEPattern> SSTrackFrame::DicLUT_6bit{
+constexpr static std::array<RLEPattern, SSTrackTables::Dic_6bit_size> const
+        DicLUT_6bit{
         RLEPattern(make_block_tile(0x0007, 0, 0, 0, 0), 0x0001),
         RLEPattern(make_block_tile(0x0001, 0, 0, 0, 0), 0x0001),
         RLEPattern(make_block_tile(0x004A, 0, 0, 0, 0), 0x0001),
@@ -845,7 +1331,8 @@ vector<RLEPattern> SSTrackFrame::DicLUT_6bit{
         RLEPattern(make_block_tile(0x0007, 0, 0, 0, 0), 0x0004),
         RLEPattern(make_block_tile(0x000B, 0, 0, 0, 0), 0x0003)};
 
-vector<RLEPattern> SSTrackFrame::DicLUT_7bit{
+constexpr static std::array<RLEPattern, SSTrackTables::Dic_7bit_size> const
+        DicLUT_7bit{
         RLEPattern(make_block_tile(0x001D, 0, 0, 0, 0), 0x001B),
         RLEPattern(make_block_tile(0x004A, 0, 0, 0, 0), 0x0006),
         RLEPattern(make_block_tile(0x001D, 0, 0, 0, 0), 0x001D),
@@ -916,3 +1403,45 @@ vector<RLEPattern> SSTrackFrame::DicLUT_7bit{
         RLEPattern(make_block_tile(0x002C, 0, 0, 0, 0), 0x000C),
         RLEPattern(make_block_tile(0x002C, 0, 0, 0, 0), 0x000F),
         RLEPattern(make_block_tile(0x002C, 0, 0, 0, 0), 0x0010)};
+
+constexpr static SSTrackTables const standard_tables(
+        SymLUT_6bit, SymLUT_10bit, DicLUT_6bit, DicLUT_7bit);
+
+SSTrackTables const& SSTrackTables::standard() noexcept {
+    return standard_tables;
+}
+
+bool SSTrackTables::load(
+        span<uint8_t const> data, size_t const sym_10bit_count,
+        size_t const dic_7bit_count) noexcept {
+    if (sym_10bit_count > Max_sym_10bit_size
+        || dic_7bit_count > Max_dic_7bit_size) {
+        return false;
+    }
+    size_t const sym_count = Sym_6bit_size + sym_10bit_count;
+    size_t const dic_count = Dic_6bit_size + dic_7bit_count;
+    if (data.size() < sym_count * 2 + dic_count * 4) {
+        return false;
+    }
+    auto const read_word = [&](size_t const index) {
+        return static_cast<uint16_t>(
+                (data[index * 2] << 8U) | data[index * 2 + 1]);
+    };
+    std::array<Pattern_Name, Sym_6bit_size + Max_sym_10bit_size> syms;
+    for (size_t ii = 0; ii < sym_count; ii++) {
+        syms[ii] = Pattern_Name(read_word(ii));
+    }
+    std::array<RLEPattern, Dic_6bit_size + Max_dic_7bit_size> dics;
+    for (size_t ii = 0; ii < dic_count; ii++) {
+        size_t const word = sym_count + ii * 2;
+        dics[ii]          = RLEPattern(
+                Pattern_Name(read_word(word)), read_word(word + 1));
+    }
+    span<Pattern_Name const> const sym_span(syms.data(), sym_count);
+    span<RLEPattern const> const   dic_span(dics.data(), dic_count);
+    *this = SSTrackTables(
+            sym_span.first<Sym_6bit_size>(),
+            sym_span.subspan(Sym_6bit_size), dic_span.first<Dic_6bit_size>(),
+            dic_span.subspan(Dic_6bit_size));
+    return true;
+}
@@ -19,10 +19,14 @@
 #include <mdcomp/kosinski.hh>
 #include <mdtools/ssvram.hh>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <span>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 using std::ios;
@@ -47,15 +51,15 @@ SSVRAM::SSVRAM(istream& palette_file, istream& art_file) noexcept {
     reserve_tiles(count);
 
     for (unsigned ii = 0; ii < count; ii++) {
-        auto& tile   = new_tile();
-        auto  dst1   = tile.begin(NoFlip);
-        auto  dst2   = dst1 + ShortTile::Line_size;
-        auto  finish = tile.end(NoFlip);
-        for (; decoded_art.good() && dst2 != finish; ++dst1, ++dst2) {
-            uint32_t value = static_cast<uint8_t>(decoded_art.get());
-            *dst1++ = *dst2++ = (value >> 4U) & 0xfU;
-            *dst1 = *dst2 = value & 0xfU;
+        // The bytes of a line are the same as in VRAM, and both lines are the
+        // same.
+        std::array<uint8_t, ShortTile::Byte_size> bytes{};
+        constexpr size_t const line_bytes = ShortTile::Line_size / 2;
+        for (size_t jj = 0; decoded_art.good() && jj < line_bytes; jj++) {
+            bytes[jj] = bytes[jj + line_bytes]
+                    = static_cast<uint8_t>(decoded_art.get());
         }
+        push_back(Packed_t(bytes.data()));
     }
 
     auto const start = palette_file.tellg();
@@ -68,34 +72,8 @@ SSVRAM::SSVRAM(istream& palette_file, istream& art_file) noexcept {
     for (size_t ii = 0; ii < palLen; ii++) {
         palette[ii] = BigEndian::Read2(palette_file);
     }
-    auto const getRed = [](uint32_t const color) -> uint32_t {
-        return color & 0xfU;
-    };
-    auto const getGreen = [](uint32_t const color) -> uint32_t {
-        return (color >> 4U) & 0xfU;
-    };
-    auto const getBlue = [](uint32_t const color) -> uint32_t {
-        return (color >> 8U) & 0xfU;
-    };
-    auto const deltaSquare
-            = [](int const color1, int const color2) -> unsigned {
-        return (color1 - color2) * (color1 - color2);
-    };
-    auto const distance = [&deltaSquare, &getRed, &getGreen, &getBlue](
-                                  uint16_t const color1,
-                                  uint16_t const color2) -> unsigned {
-        return deltaSquare(getRed(color1), getRed(color2))
-               + deltaSquare(getGreen(color1), getGreen(color2))
-               + deltaSquare(getBlue(color1), getBlue(color2));
-    };
-    auto& DistTable = get_dist_table();
-    for (size_t ii = 0; ii < 16; ii++) {
-        DistTable[ii][ii] = 0;
-        for (size_t jj = ii + 1; jj < 16; jj++) {
-            DistTable[ii][jj] = DistTable[jj][ii]
-                    = distance(palette[ii], palette[jj]);
-        }
-    }
+    get_dist_table() = palette_dist_table(
+            std::span<uint16_t const, 16>(palette.data(), 16));
 }
 
 // Splits the given full-sized tile into 4 short (2-line) tiles.
@@ -109,11 +87,12 @@ vector<ShortTile> split_tile(Tile const& tile) noexcept {
     vector<ShortTile> new_tiles;
     new_tiles.reserve(4);
 
-    auto start = tile.begin(NoFlip);
+    uint8_t const* pixels = tile.data();
     for (unsigned ii = 0; ii < Tile::Num_lines / ShortTile::Num_lines; ii++) {
         // Want to copy 2 lines.
-        auto const finish = start + 2 * ShortTile::Line_size;
-        new_tiles.emplace_back(start, finish, NoFlip, 1);
+        auto& short_tile = new_tiles.emplace_back();
+        std::copy_n(pixels, ShortTile::Tile_size, short_tile.data());
+        pixels += ShortTile::Tile_size;
     }
     return new_tiles;
 }
@@ -123,27 +102,20 @@ Tile merge_tiles(
         ShortTile const& tile0, FlipMode const flip0, ShortTile const& tile1,
         FlipMode const flip1, ShortTile const& tile2, FlipMode const flip2,
         ShortTile const& tile3, FlipMode const flip3) noexcept {
-    Tile dest;
-    auto iter = dest.begin(NoFlip);
-    for (auto source = tile0.begin(flip0);
-         iter != dest.end(NoFlip) && source != tile0.end(flip0);
-         ++iter, ++source) {
-        *iter = *source;
-    }
-    for (auto source = tile1.begin(flip1);
-         iter != dest.end(NoFlip) && source != tile1.end(flip1);
-         ++iter, ++source) {
-        *iter = *source;
-    }
-    for (auto source = tile2.begin(flip2);
-         iter != dest.end(NoFlip) && source != tile2.end(flip2);
-         ++iter, ++source) {
-        *iter = *source;
-    }
-    for (auto source = tile3.begin(flip3);
-         iter != dest.end(NoFlip) && source != tile3.end(flip3);
-         ++iter, ++source) {
-        *iter = *source;
+    static_assert(
+            Tile::Tile_size == 4 * ShortTile::Tile_size,
+            "Mismatched tile sizes!");
+    std::array<std::pair<ShortTile const*, FlipMode>, 4> const sources{
+            {{&tile0, flip0},
+             {&tile1, flip1},
+             {&tile2, flip2},
+             {&tile3, flip3}}};
+    Tile     dest;
+    uint8_t* pixels = dest.data();
+    for (auto const& [source, flip] : sources) {
+        auto const flipped = source->flipped(flip);
+        std::copy(flipped.cbegin(), flipped.cend(), pixels);
+        pixels += ShortTile::Tile_size;
     }
     return dest;
 }
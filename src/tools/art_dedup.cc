@@ -0,0 +1,629 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <mdcomp/bigendian_io.hh>
+#include <mdtools/mapped_file.hh>
+#include <mdtools/mappingfile.hh>
+#include <mdtools/tile_reducer.hh>
+#include <mdtools/vram.hh>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::ios;
+using std::istream;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::unordered_multimap;
+using std::vector;
+
+static void usage() {
+    cerr << "Usage: art_dedup [OPTIONS] INPUT_ART OUTPUT_ART" << endl;
+    cerr << "\tRemoves duplicate tiles from the uncompressed INPUT_ART, "
+            "including copies that are X, Y or XY flipped versions of"
+         << endl
+         << "\tanother tile, and writes the remaining tiles to OUTPUT_ART. "
+            "Plane maps and mappings that use the art are"
+         << endl
+         << "\trewritten to refer to the remaining copy of each tile, with "
+            "the right flip."
+         << endl
+         << endl;
+    cerr << "\tTiles used by multi-tile mapping pieces must stay together, so "
+            "they are never removed; instead, pieces whose"
+         << endl
+         << "\ttiles are a copy of those of another piece, possibly "
+            "flipped, are changed to use the tiles of the latter."
+         << endl
+         << endl;
+    cerr << "\tWith --budget, if more tiles than that remain, the tiles that "
+            "are most alike are merged (lossy) until it is met."
+         << endl
+         << "\tThe closeness of colors comes from the palette, if given; "
+            "otherwise, it is the count of different pixels."
+         << endl
+         << endl;
+    cerr << "Available options are:" << endl;
+    cerr << "\t-p, --plane=IN,OUT   \tUncompressed plane map IN refers to "
+            "the art; the new plane map is written to OUT."
+         << endl;
+    cerr << "\t-m, --mappings=IN,OUT\tMappings file IN refers to the art "
+            "directly (not through DPLCs); the new mappings"
+         << endl
+         << "\t                     \tare written to OUT." << endl;
+    cerr << "\t--sonic=VER          \tSpecifies the game engine version "
+            "(format) of the mappings, as in mapping_tool."
+         << endl
+         << "\t                     \tDefaults to Sonic 2 format." << endl;
+    cerr << "\t-0, --no-null        \tDisables null first frame optimization "
+            "in the mappings."
+         << endl;
+    cerr << "\t-b, --budget=N       \tMerges similar tiles until at most N "
+            "remain (at most 0x800). Tiles of multi-tile"
+         << endl
+         << "\t                     \tpieces are never merged, but count "
+            "towards N."
+         << endl;
+    cerr << "\t-c, --palette=FILE   \tPalette for measuring how alike tiles "
+            "are, in Mega Drive format."
+         << endl;
+    cerr << "\t-l, --line=N         \tPalette line to use, from 0 to 3. "
+            "Defaults to 0."
+         << endl;
+    cerr << "\t-j, --threads=N      \tUses up to N threads for merging. "
+            "Defaults to one per core."
+         << endl;
+    cerr << "\t-n, --dry-run        \tOnly reports how many tiles would be "
+            "saved, and writes no files."
+         << endl
+         << endl;
+}
+
+// Where the remaining copy of a tile, or of the tiles of a mapping piece, is
+// in the input art, and which flip turns that copy into the original.
+struct Placement {
+    size_t   index;
+    FlipMode flip;
+};
+
+// Tiles used by a multi-tile mapping piece. They go down each column first.
+struct Block {
+    size_t  start;
+    uint8_t width;
+    uint8_t height;
+
+    [[nodiscard]] size_t count() const noexcept {
+        return size_t(width) * size_t(height);
+    }
+    [[nodiscard]] auto operator<=>(Block const& right) const noexcept = default;
+};
+
+static constexpr std::array<FlipMode, 4> const modes{
+        NoFlip, XFlip, YFlip, XYFlip};
+
+static FlipMode get_flip(single_mapping const& piece) noexcept {
+    return static_cast<FlipMode>((piece.flags >> 3U) & 3U);
+}
+static void set_flip(single_mapping& piece, FlipMode const flip) noexcept {
+    piece.flags = static_cast<uint16_t>(
+            (piece.flags & ~0x18U) | (static_cast<uint32_t>(flip) << 3U));
+}
+
+// The art is compared in its packed form, which is also how it is written back.
+using Tiles = VRAM<Tile>::Tiles;
+
+class Deduplicator {
+    Tiles const&          tiles;
+    vector<Placement>     placements;
+    vector<size_t>        new_index;
+    map<Block, Placement> blocks;
+    vector<bool>          pinned;
+    vector<uint32_t>      uses;
+
+    void renumber() {
+        // The tiles that remain keep their order.
+        tile_count = 0;
+        new_index.resize(tiles.size());
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            if (placements[ii].index == ii) {
+                new_index[ii] = tile_count++;
+            }
+        }
+    }
+
+public:
+    size_t exact_copies   = 0;
+    size_t flipped_copies = 0;
+    size_t block_copies   = 0;
+    size_t tile_count     = 0;
+    size_t merged_tiles   = 0;
+    // Sum of the distances of merged tiles to their replacements, times the
+    // number of uses by plane maps and single-tile pieces.
+    uint64_t merge_error = 0;
+
+    explicit Deduplicator(Tiles const& tiles_)
+            : tiles(tiles_), pinned(tiles_.size(), false),
+              uses(tiles_.size(), 0) {}
+
+    // Packed pixels of the block of tiles as seen with the given flip mode.
+    [[nodiscard]] vector<uint8_t> block_pixels(
+            Block const& block, FlipMode const flip) const {
+        vector<uint8_t> pixels(block.count() * Tile::Byte_size);
+        uint8_t*        bytes = pixels.data();
+        for (size_t col = 0; col < block.width; col++) {
+            size_t const from_col
+                    = (flip & XFlip) != 0 ? block.width - 1 - col : col;
+            for (size_t row = 0; row < block.height; row++) {
+                size_t const from_row
+                        = (flip & YFlip) != 0 ? block.height - 1 - row : row;
+                size_t const index
+                        = block.start + from_col * block.height + from_row;
+                tiles[index].flipped(flip).write(bytes);
+                bytes += Tile::Byte_size;
+            }
+        }
+        return pixels;
+    }
+
+    // Counts a use of the tile by a plane map.
+    void add_use(size_t const index) noexcept {
+        uses[index]++;
+    }
+
+    // Registers the tiles used by a mapping piece. Returns false if they are
+    // not all in the art.
+    bool add_piece(single_mapping const& piece) {
+        Block const block{piece.tile, piece.sx, piece.sy};
+        if (block.start + block.count() > tiles.size()) {
+            return false;
+        }
+        if (block.count() > 1) {
+            blocks.emplace(block, Placement{block.start, NoFlip});
+        } else {
+            add_use(block.start);
+        }
+        return true;
+    }
+
+    void run() {
+        // First, pieces whose tiles are copies of those of earlier pieces.
+        using Views = std::array<vector<uint8_t>, 4>;
+        vector<std::pair<Block, Views>>      kept;
+        unordered_multimap<uint64_t, size_t> block_index;
+        for (auto& [block, placement] : blocks) {
+            Views views;
+            for (auto const mode : modes) {
+                views[mode] = block_pixels(block, mode);
+            }
+            uint64_t key = ~0ULL;
+            for (auto const& view : views) {
+                key = std::min(key, hash_pixels(view.data(), view.size()));
+            }
+            key ^= (size_t(block.width) << 8U) | block.height;
+            bool found      = false;
+            auto [beg, end] = block_index.equal_range(key);
+            for (; beg != end; ++beg) {
+                auto const& [other, other_views] = kept[beg->second];
+                if (other.width != block.width || other.height != block.height
+                    || (found && other.start >= placement.index)) {
+                    continue;
+                }
+                for (auto const mode : modes) {
+                    if (other_views[mode] == views[NoFlip]) {
+                        placement = {other.start, mode};
+                        found     = true;
+                        break;
+                    }
+                }
+            }
+            if (found) {
+                block_copies++;
+                continue;
+            }
+            for (size_t ii = 0; ii < block.count(); ii++) {
+                pinned[block.start + ii] = true;
+            }
+            block_index.emplace(key, kept.size());
+            kept.emplace_back(block, std::move(views));
+        }
+
+        // Now the tiles. The tiles of the pieces that were kept must stay, so
+        // they go into the index first.
+        unordered_multimap<uint64_t, size_t> tile_index;
+        placements.resize(tiles.size());
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            if (pinned[ii]) {
+                placements[ii] = {ii, NoFlip};
+                tile_index.emplace(tiles[ii].canonical_hash(), ii);
+            }
+        }
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            if (pinned[ii]) {
+                continue;
+            }
+            uint64_t const hash      = tiles[ii].canonical_hash();
+            bool           found     = false;
+            Placement&     placement = placements[ii];
+            auto [beg, end]          = tile_index.equal_range(hash);
+            for (; beg != end; ++beg) {
+                size_t const other = beg->second;
+                if (found && other >= placement.index) {
+                    continue;
+                }
+                for (auto const mode : modes) {
+                    if (tiles[other].flipped(mode) == tiles[ii]) {
+                        placement = {other, mode};
+                        found     = true;
+                        break;
+                    }
+                }
+            }
+            if (!found) {
+                placement = {ii, NoFlip};
+                tile_index.emplace(hash, ii);
+            } else if (placement.flip == NoFlip) {
+                exact_copies++;
+            } else {
+                flipped_copies++;
+            }
+        }
+
+        renumber();
+    }
+
+    // Merges the remaining tiles that are most alike, with the given distance
+    // table, until at most budget of them remain. Must be called after run.
+    // Fails if the tiles that must be kept do not fit in the pattern names.
+    [[nodiscard]] bool reduce(
+            size_t const budget, DistTable_t const& table,
+            unsigned const num_threads) {
+        if (tile_count <= budget) {
+            return true;
+        }
+        vector<Tile>     kept;
+        vector<size_t>   origin;
+        vector<uint32_t> weights(tile_count, 0);
+        kept.reserve(tile_count);
+        origin.reserve(tile_count);
+        for (size_t ii = 0; ii < tiles.size(); ii++) {
+            if (is_kept(ii)) {
+                kept.push_back(tiles[ii].unpack());
+                origin.push_back(ii);
+            }
+            weights[new_index[placements[ii].index]] += uses[ii];
+        }
+        TileReducer<Tile> reducer(table, kept, weights, num_threads);
+        for (size_t ii = 0; ii < kept.size(); ii++) {
+            if (pinned[origin[ii]]) {
+                reducer.keep(ii);
+            }
+        }
+        if (!reducer.can_reduce()) {
+            return false;
+        }
+        auto const choices = reducer.reduce(budget);
+        for (size_t ii = 0; ii < choices.size(); ii++) {
+            if (choices[ii].medoid != ii) {
+                merged_tiles++;
+                merge_error += uint64_t(weights[ii]) * choices[ii].distance;
+            }
+        }
+        for (auto& placement : placements) {
+            auto const& choice = choices[new_index[placement.index]];
+            placement = {origin[choice.medoid], placement.flip ^ choice.flip};
+        }
+        renumber();
+        return true;
+    }
+
+    [[nodiscard]] bool is_kept(size_t const index) const noexcept {
+        return placements[index].index == index;
+    }
+
+    void remap(Pattern_Name& pattern) const noexcept {
+        Placement const& placement = placements[pattern.get_tile()];
+        pattern.set_tile(static_cast<uint16_t>(new_index[placement.index]));
+        pattern.set_flip(pattern.get_flip() ^ placement.flip);
+    }
+    void remap(single_mapping& piece) const {
+        Block const block{piece.tile, piece.sx, piece.sy};
+        Placement const& placement = block.count() > 1
+                                             ? blocks.at(block)
+                                             : placements[block.start];
+        piece.tile = static_cast<uint16_t>(new_index[placement.index]);
+        set_flip(piece, get_flip(piece) ^ placement.flip);
+    }
+};
+
+// Splits IN,OUT option arguments.
+static bool split_files(
+        char const* argument, vector<std::pair<string, string>>& files) {
+    string const value(argument);
+    auto const   comma = value.find(',');
+    if (comma == string::npos || comma == 0 || comma + 1 == value.size()) {
+        return false;
+    }
+    files.emplace_back(value.substr(0, comma), value.substr(comma + 1));
+    return true;
+}
+
+// Distance table for the given palette line, or one that counts different
+// pixels if there is no palette.
+static bool read_dist_table(
+        string const& name, size_t const line, DistTable_t& table) {
+    if (name.empty()) {
+        for (size_t ii = 0; ii < 16; ii++) {
+            for (size_t jj = 0; jj < 16; jj++) {
+                table[ii][jj] = ii == jj ? 0 : 1;
+            }
+        }
+        return true;
+    }
+    ifstream input(name, ios::in | ios::binary);
+    input.seekg(static_cast<std::streamoff>(line * 16 * sizeof(uint16_t)));
+    std::array<uint16_t, 16> palette{};
+    for (auto& color : palette) {
+        color = BigEndian::Read2(input);
+    }
+    if (!input.good()) {
+        return false;
+    }
+    table = palette_dist_table(palette);
+    return true;
+}
+
+static vector<Pattern_Name> read_plane(istream& input) {
+    vector<Pattern_Name> plane;
+    while (true) {
+        uint16_t const value = BigEndian::Read2(input);
+        if (!input.good()) {
+            break;
+        }
+        plane.emplace_back(value);
+    }
+    return plane;
+}
+
+int main(int argc, char* argv[]) {
+    constexpr static const std::array long_options{
+            option{"plane", required_argument, nullptr, 'p'},
+            option{"mappings", required_argument, nullptr, 'm'},
+            option{"sonic", required_argument, nullptr, 'z'},
+            option{"no-null", no_argument, nullptr, '0'},
+            option{"budget", required_argument, nullptr, 'b'},
+            option{"palette", required_argument, nullptr, 'c'},
+            option{"line", required_argument, nullptr, 'l'},
+            option{"threads", required_argument, nullptr, 'j'},
+            option{"dry-run", no_argument, nullptr, 'n'},
+            option{nullptr, 0, nullptr, 0}};
+
+    vector<std::pair<string, string>> plane_files;
+    vector<std::pair<string, string>> mapping_files;
+    bool                              null_first    = true;
+    bool                              dry_run       = false;
+    int64_t                           sonic_version = 2;
+    size_t                            budget        = 0;
+    string                            palette_file;
+    size_t                            palette_line = 0;
+    unsigned                          num_threads  = 0;
+
+    while (true) {
+        int option_index = 0;
+        int option_char  = getopt_long(
+                 argc, argv, "p:m:b:c:l:j:0n", long_options.data(),
+                 &option_index);
+        if (option_char == -1) {
+            break;
+        }
+
+        switch (option_char) {
+        case 'p':
+            if (!split_files(optarg, plane_files)) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'm':
+            if (!split_files(optarg, mapping_files)) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'z':
+            sonic_version = strtol(optarg, nullptr, 0);
+            if (sonic_version < 1 || sonic_version > 4) {
+                sonic_version = 2;
+            }
+            break;
+        case 'b':
+            budget = strtoul(optarg, nullptr, 0);
+            if (budget == 0 || budget > TileReducer<Tile>::Max_tiles) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'c':
+            palette_file = optarg;
+            break;
+        case 'l':
+            palette_line = strtoul(optarg, nullptr, 0);
+            if (palette_line > 3) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'j':
+            num_threads = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            break;
+        case '0':
+            null_first = false;
+            break;
+        case 'n':
+            dry_run = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (argc - optind < 2) {
+        usage();
+        return 1;
+    }
+
+    MappedFile const input_art(argv[optind + 0]);
+    if (!input_art.good()) {
+        cerr << "Could not read from art file '" << argv[optind + 0] << "'."
+             << endl;
+        return 2;
+    }
+    VRAM<Tile> const art(input_art.bytes());
+    Deduplicator     dedup(art.get_tiles());
+
+    vector<vector<Pattern_Name>> planes;
+    for (auto const& [name, ignore] : plane_files) {
+        ifstream input(name, ios::in | ios::binary);
+        if (!input.good()) {
+            cerr << "Could not read from plane map file '" << name << "'."
+                 << endl;
+            return 3;
+        }
+        planes.push_back(read_plane(input));
+        for (auto const& pattern : planes.back()) {
+            if (pattern.get_tile() >= art.size()) {
+                cerr << "Plane map file '" << name
+                     << "' uses tiles that are not in the art." << endl;
+                return 3;
+            }
+            dedup.add_use(pattern.get_tile());
+        }
+    }
+
+    vector<mapping_file> mappings;
+    for (auto const& [name, ignore] : mapping_files) {
+        ifstream input(name, ios::in | ios::binary);
+        if (!input.good()) {
+            cerr << "Could not read from mappings file '" << name << "'."
+                 << endl;
+            return 4;
+        }
+        mappings.emplace_back(input, sonic_version);
+        for (auto const& frame : mappings.back().frames) {
+            for (auto const& piece : frame.maps) {
+                if (!dedup.add_piece(piece)) {
+                    cerr << "Mappings file '" << name
+                         << "' uses tiles that are not in the art." << endl;
+                    return 4;
+                }
+            }
+        }
+    }
+
+    DistTable_t table{};
+    if (!read_dist_table(palette_file, palette_line, table)) {
+        cerr << "Could not read palette line " << palette_line
+             << " from palette file '" << palette_file << "'." << endl;
+        return 8;
+    }
+
+    dedup.run();
+    size_t const lossless_count = dedup.tile_count;
+    if (budget != 0 && !dedup.reduce(budget, table, num_threads)) {
+        cerr << "Tiles of multi-tile pieces alone exceed the limit of "
+             << TileReducer<Tile>::Max_tiles << " tiles." << endl;
+        return 9;
+    }
+
+    cout << "Input tiles:     " << art.size() << endl;
+    cout << "Output tiles:    " << dedup.tile_count << endl;
+    cout << "Tiles saved:     " << art.size() - lossless_count << " ("
+         << dedup.exact_copies << " exact copies, " << dedup.flipped_copies
+         << " flipped copies)" << endl;
+    cout << "Pieces changed:  " << dedup.block_copies
+         << " multi-tile blocks reused" << endl;
+    if (budget != 0) {
+        cout << "Tiles merged:    " << dedup.merged_tiles << " (weighted error "
+             << dedup.merge_error << ")" << endl;
+        if (dedup.tile_count > budget) {
+            cerr << "Tiles of multi-tile pieces alone exceed the budget of "
+                 << budget << " tiles." << endl;
+        }
+    }
+    if (dry_run) {
+        return 0;
+    }
+
+    VRAM<Tile> output_art;
+    output_art.reserve_tiles(dedup.tile_count);
+    for (size_t ii = 0; ii < art.size(); ii++) {
+        if (dedup.is_kept(ii)) {
+            output_art.push_back(art.get_tiles()[ii]);
+        }
+    }
+    ofstream art_output(argv[optind + 1], ios::out | ios::binary | ios::trunc);
+    if (!art_output.good()) {
+        cerr << "Could not open output art file '" << argv[optind + 1] << "'."
+             << endl;
+        return 5;
+    }
+    output_art.write(art_output);
+
+    for (size_t ii = 0; ii < planes.size(); ii++) {
+        ofstream output(
+                plane_files[ii].second, ios::out | ios::binary | ios::trunc);
+        if (!output.good()) {
+            cerr << "Could not open output plane map file '"
+                 << plane_files[ii].second << "'." << endl;
+            return 6;
+        }
+        for (auto& pattern : planes[ii]) {
+            dedup.remap(pattern);
+            pattern.write(output);
+        }
+    }
+
+    for (size_t ii = 0; ii < mappings.size(); ii++) {
+        ofstream output(
+                mapping_files[ii].second, ios::out | ios::binary | ios::trunc);
+        if (!output.good()) {
+            cerr << "Could not open output mappings file '"
+                 << mapping_files[ii].second << "'." << endl;
+            return 7;
+        }
+        for (auto& frame : mappings[ii].frames) {
+            for (auto& piece : frame.maps) {
+                dedup.remap(piece);
+            }
+        }
+        mappings[ii].write(output, sonic_version, null_first);
+    }
+    return 0;
+}
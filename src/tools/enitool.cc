@@ -16,16 +16,18 @@
  */
 
 #include <getopt.h>
-#include <mdcomp/bigendian_io.hh>
 #include <mdcomp/enigma.hh>
+#include <mdtools/pattern_name_transform.hh>
+#include <mdtools/plane.hh>
+#include <mdtools/span_stream.hh>
 
 #include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <set>
 #include <sstream>
+#include <vector>
 
 using std::cerr;
 using std::cout;
@@ -33,7 +35,6 @@ using std::endl;
 using std::ifstream;
 using std::ios;
 using std::ofstream;
-using std::set;
 using std::stringstream;
 
 static void usage(char* prog) {
@@ -43,7 +44,8 @@ static void usage(char* prog) {
          << endl
          << endl;
     cerr << "Usage: " << prog
-         << "[-b num|--blacklist=num]* [-p num|--palette num] delta {filename}"
+         << "[-b num|--blacklist=num]* [-w num|--whitelist=num]* [-c|--clamp] "
+            "[-p num|--palette num] delta {filename}"
          << endl
          << endl;
     cerr << "\tDecompresses enigma mappings, adds the (unsigned) value "
@@ -56,7 +58,17 @@ static void usage(char* prog) {
     cerr << "\t-b,--blacklist\tCan be used 0 or more times; it is a list of "
             "values that ought "
          << endl;
-    cerr << "\t              \tbe left untouched in the file." << endl << endl;
+    cerr << "\t              \tbe left untouched in the file." << endl;
+    cerr << "\t-w,--whitelist\tCan be used 0 or more times; if used, only "
+            "these values are changed."
+         << endl;
+    cerr << "\t              \tValues that are also blacklisted are still "
+            "left untouched."
+         << endl;
+    cerr << "\t-c,--clamp    \tClamp tiles to [0, 0x7FF] instead of wrapping "
+            "around."
+         << endl
+         << endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -64,16 +76,19 @@ int main(int argc, char* argv[]) {
             option{"size", no_argument, nullptr, 's'},
             option{"palette", required_argument, nullptr, 'p'},
             option{"blacklist", required_argument, nullptr, 'b'},
+            option{"whitelist", required_argument, nullptr, 'w'},
+            option{"clamp", no_argument, nullptr, 'c'},
             option{nullptr, 0, nullptr, 0}};
 
-    set<uint16_t> blacklist;
-    bool          size_only     = false;
-    uint16_t      palette_delta = 0;
+    Pattern_Name_Transform transform;
+    TileOverflow           overflow      = TileOverflow::Wrap;
+    bool                   size_only     = false;
+    uint32_t               palette_delta = 0;
 
     while (true) {
         int option_index = 0;
         int option_char  = getopt_long(
-                 argc, argv, "sb:p:", long_options.data(), &option_index);
+                 argc, argv, "sb:w:cp:", long_options.data(), &option_index);
         if (option_char == -1) {
             break;
         }
@@ -81,16 +96,24 @@ int main(int argc, char* argv[]) {
         switch (option_char) {
         case 'p':
             if (optarg != nullptr) {
-                palette_delta = static_cast<uint16_t>(
-                        (strtoul(optarg, nullptr, 0) & 3U) << 13U);
+                palette_delta = strtoul(optarg, nullptr, 0) & 3U;
             }
             break;
         case 'b':
             if (optarg != nullptr) {
-                blacklist.insert(static_cast<uint16_t>(
+                transform.blacklist(static_cast<uint16_t>(
+                        strtoul(optarg, nullptr, 0) & 0x7FFU));
+            }
+            break;
+        case 'w':
+            if (optarg != nullptr) {
+                transform.whitelist(static_cast<uint16_t>(
                         strtoul(optarg, nullptr, 0) & 0x7FFU));
             }
             break;
+        case 'c':
+            overflow = TileOverflow::Clamp;
+            break;
         case 's':
             size_only = true;
             break;
@@ -112,6 +135,7 @@ int main(int argc, char* argv[]) {
             cerr << "Adding zero to tile... aborting." << endl << endl;
             return 2;
         }
+        transform.offset_tiles(delta, overflow).offset_palettes(palette_delta);
     }
 
     ifstream input(argv[optind], ios::in | ios::binary);
@@ -125,10 +149,10 @@ int main(int argc, char* argv[]) {
     stringstream inbuffer(ios::in | ios::out | ios::binary);
     enigma::decode(input, inbuffer);
     input.close();
+    size_t const words = static_cast<size_t>(inbuffer.tellp()) / 2;
 
     if (size_only) {
-        inbuffer.seekg(0, ios::end);
-        cout << inbuffer.tellg() / 2 << endl;
+        cout << words << endl;
     } else {
         ofstream output(argv[optind], ios::out | ios::binary);
         if (!output.good()) {
@@ -138,27 +162,14 @@ int main(int argc, char* argv[]) {
             return 4;
         }
 
-        inbuffer.seekg(0);
-        stringstream output_buffer(ios::in | ios::out | ios::binary);
-        size_t       count = 0;
-        while (true) {
-            uint16_t value = BigEndian::Read2(inbuffer);
-            if (!inbuffer.good()) {
-                break;
-            }
-            uint32_t tile    = value & 0x7FFU;
-            uint32_t palette = value & 0x6000U;
-            uint32_t flags   = value & 0x9800U;
-            if (blacklist.find(tile) == blacklist.cend()) {
-                value = ((tile + delta) & 0x7FFU)
-                        | ((palette + palette_delta) & 0x6000U) | flags;
-            }
-            BigEndian::Write2(output_buffer, value);
-            count++;
-        }
-        cout << count << endl;
+        // The decoded size is only known now, so the words are read from the
+        // decode buffer straight into the plane.
+        Plane plane(words, 1, inbuffer, false);
+        transform.apply(plane.cells());
+        cout << plane.width() << endl;
 
-        output_buffer.seekg(0);
+        std::vector<uint8_t> const encoded = plane.pack();
+        SpanInputStream            output_buffer(encoded);
         enigma::encode(output_buffer, output);
     }
 
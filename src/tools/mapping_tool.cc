@@ -16,17 +16,28 @@
  */
 
 #include <getopt.h>
+#include <mdtools/art_order.hh>
+#include <mdtools/delta_dplc.hh>
+#include <mdtools/dma_timing.hh>
 #include <mdtools/dplcfile.hh>
 #include <mdtools/mappingfile.hh>
 
+#include <algorithm>
 #include <array>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 using std::cerr;
+using std::cout;
 using std::endl;
 using std::ifstream;
 using std::ios;
@@ -34,6 +45,7 @@ using std::istream;
 using std::ofstream;
 using std::ostream;
 using std::string;
+using std::vector;
 
 static void usage() {
     cerr << "Usage: mapping_tool {-c|--crush-mappings} [OPTIONS] INPUT_MAPS "
@@ -63,6 +75,52 @@ static void usage() {
             "files to use as few DMA transfers as possible."
          << endl
          << endl;
+    cerr << "Usage: mapping_tool {-r|--reorder-art} [OPTIONS] INPUT_ART "
+            "INPUT_MAPS INPUT_DPLC OUTPUT_ART OUTPUT_MAPS OUTPUT_DPLC"
+         << endl;
+    cerr << "\tReorders the tiles of the uncompressed art so that the DPLC "
+            "files use as few DMA transfers as possible, first in"
+         << endl
+         << "\ttotal, then for the frame that uses the most. The tiles of "
+            "each mapping piece stay together. Writes the new"
+         << endl
+         << "\tart, mappings and DPLC." << endl
+         << endl;
+    cerr << "Usage: mapping_tool {-e|--delta-dplc} [OPTIONS] INPUT_MAPS "
+            "INPUT_DPLC SEQUENCES OUTPUT_MAPS OUTPUT_DPLC"
+         << endl;
+    cerr << "\tAdds frames for the animation sequences in SEQUENCES, one per "
+            "line, given as lists of frame numbers separated"
+         << endl
+         << "\tby spaces or commas. Tiles shared by frames of a sequence stay "
+            "in VRAM after its first frame, so the others"
+         << endl
+         << "\tonly load their own tiles. Writes the new mappings and DPLC, "
+            "and prints the sequences with the new frame"
+         << endl
+         << "\tnumbers, which are only valid when played in order from the "
+            "start of the sequence."
+         << endl
+         << endl;
+    cerr << "Usage: mapping_tool {-b|--dma-budget} [OPTIONS] INPUT_DPLC..."
+         << endl;
+    cerr << "\tPrints, as CSV, the tiles, bytes and DMA transfers each frame "
+            "of the DPLC files needs, with the scanlines and"
+         << endl
+         << "\tmicroseconds the VDP takes for them in active display and in "
+            "vertical blank. Every regular file in a directory"
+         << endl
+         << "\tis read as a DPLC file, in name order, so directories must "
+            "hold nothing else. All files are read, and checked"
+         << endl
+         << "\tagainst --sequences, before anything is printed. Frames that "
+            "need more bytes than the budget are flagged."
+         << endl
+         << "\tWith --sequences, also prints the totals for one pass of each "
+            "animation sequence, which loads a frame only"
+         << endl
+         << "\tif it is not the same as the last one." << endl
+         << endl;
     cerr << "Usage: mapping_tool {-s|--split} [OPTIONS] INPUT_MAPS OUTPUT_MAPS "
             "OUTPUT_DPLC"
          << endl;
@@ -113,6 +171,38 @@ static void usage() {
          << "\t                \tis not a guarantee. Complaints about SonMapEd "
             "should go to Xenowhirl."
          << endl;
+    cerr << "\t-t, --share-tails\tIn the mappings and DPLC files written, "
+            "stores frames that are found inside larger frames"
+         << endl
+         << "\t                \tin those frames instead of on their own. "
+            "Offsets stay word-aligned, except for Sonic 1,"
+         << endl
+         << "\t                \twhich reads bytes. The bytes saved are "
+            "printed to stderr."
+         << endl;
+    cerr << "\t-j, --threads=N \tUses up to N threads for --reorder-art. "
+            "Defaults to one per core. The result is the same"
+         << endl
+         << "\t                \tfor any N." << endl;
+    cerr << "\t-v, --vram=N    \tLets --delta-dplc use up to N tiles of VRAM "
+            "for each sequence. Defaults to the tiles used by"
+         << endl
+         << "\t                \tits largest frame. It is an error for a "
+            "frame to need more than N tiles on its own."
+         << endl;
+    cerr << "\t-l, --limit=N   \tSets the budget for --dma-budget to N bytes "
+            "per frame. Defaults to what a whole vertical blank"
+         << endl
+         << "\t                \tcan move." << endl;
+    cerr << "\t-q, --sequences=FILE\tReads animation sequences for "
+            "--dma-budget from FILE, in the format --delta-dplc uses."
+         << endl;
+    cerr << "\t--h32           \tMakes --dma-budget use the timing of the "
+            "256 pixel wide mode. Defaults to 320 pixels wide."
+         << endl;
+    cerr << "\t--pal           \tMakes --dma-budget use the timing of PAL "
+            "consoles. Defaults to NTSC."
+         << endl;
     cerr << "\t--sonic=VER     \tShorthand for using both --from=sonic=VER and "
             "--to-sonic=VER."
          << endl;
@@ -149,7 +239,10 @@ enum Actions {
     eConvertDPLC,
     eInfo,
     eDplc,
-    ePalChange
+    ePalChange,
+    eReorderArt,
+    eDeltaDplc,
+    eDmaBudget
 };
 
 enum FileErrors {
@@ -157,9 +250,57 @@ enum FileErrors {
     eInputMapsMissing,
     eInputDplcMissing,
     eOutputMapsMissing,
-    eOutputDplcMissing
+    eOutputDplcMissing,
+    eInputArtMissing,
+    eOutputArtMissing,
+    eInvalidArt,
+    eSequencesMissing,
+    eInvalidSequences,
+    eOverVramBudget
 };
 
+// Reads animation sequences, one per line, as lists of frame numbers separated
+// by spaces or commas. Fails if a frame is not below frame_count.
+static bool read_sequences(
+        istream& input, size_t const frame_count,
+        vector<vector<size_t>>& sequences) {
+    string line;
+    while (std::getline(input, line)) {
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        vector<size_t>     sequence;
+        string             field;
+        while (fields >> field) {
+            char*        end   = nullptr;
+            size_t const frame = strtoul(field.c_str(), &end, 0);
+            if (*end != '\0' || frame >= frame_count) {
+                cerr << "Invalid frame '" << field << "' in sequence "
+                     << sequences.size() << "." << endl;
+                return false;
+            }
+            sequence.push_back(frame);
+        }
+        if (!sequence.empty()) {
+            sequences.push_back(std::move(sequence));
+        }
+    }
+    return true;
+}
+
+// One line of --dma-budget output.
+static void print_dma_row(
+        dma_timing const& timing, string const& name, char const* kind,
+        size_t const index, size_t const tiles, size_t const commands,
+        size_t const over_budget) {
+    size_t const bytes         = tiles * 32;
+    size_t const display_lines = timing.display_lines(bytes);
+    size_t const blank_lines   = timing.blank_lines(bytes);
+    cout << name << ',' << kind << ',' << index << ',' << tiles << ','
+         << bytes << ',' << commands << ',' << display_lines << ','
+         << blank_lines << ',' << timing.to_us(display_lines) << ','
+         << timing.to_us(blank_lines) << ',' << over_budget << endl;
+}
+
 #define ARG_CASE(x, y, z, w)     \
     case (x):                    \
         if (action != eNone) {   \
@@ -191,6 +332,16 @@ int main(int argc, char* argv[]) {
             option{"info", no_argument, nullptr, 'i'},
             option{"dplc", no_argument, nullptr, 'd'},
             option{"no-null", no_argument, nullptr, '0'},
+            option{"share-tails", no_argument, nullptr, 't'},
+            option{"reorder-art", no_argument, nullptr, 'r'},
+            option{"threads", required_argument, nullptr, 'j'},
+            option{"delta-dplc", no_argument, nullptr, 'e'},
+            option{"vram", required_argument, nullptr, 'v'},
+            option{"dma-budget", no_argument, nullptr, 'b'},
+            option{"limit", required_argument, nullptr, 'l'},
+            option{"sequences", required_argument, nullptr, 'q'},
+            option{"h32", no_argument, nullptr, 'H'},
+            option{"pal", no_argument, nullptr, 'P'},
             option{"pal-change", required_argument, nullptr, 'p'},
             option{"pal-dest", required_argument, nullptr, 'a'},
             option{"from-sonic", required_argument, nullptr, 'x'},
@@ -198,18 +349,26 @@ int main(int argc, char* argv[]) {
             option{"sonic", required_argument, nullptr, 'z'},
             option{nullptr, 0, nullptr, 0}};
 
-    Actions action             = eNone;
-    bool    null_first         = true;
-    int64_t num_args           = 0;
-    int64_t source_palette     = -1;
-    int64_t dest_palette       = -1;
-    int64_t to_sonic_version   = 2;
-    int64_t from_sonic_version = 2;
+    Actions  action             = eNone;
+    bool     null_first         = true;
+    bool     share_tails        = false;
+    bool     h32                = false;
+    bool     pal                = false;
+    size_t   saved              = 0;
+    unsigned num_threads        = 0;
+    size_t   vram_budget        = 0;
+    size_t   dma_budget         = 0;
+    char*    sequences_name     = nullptr;
+    int64_t  num_args           = 0;
+    int64_t  source_palette     = -1;
+    int64_t  dest_palette       = -1;
+    int64_t  to_sonic_version   = 2;
+    int64_t  from_sonic_version = 2;
 
     while (true) {
         int option_index = 0;
         int option_char  = getopt_long(
-                 argc, argv, "osmfckidp:a:0", long_options.data(),
+                 argc, argv, "osmfckidrebp:a:0tj:v:l:q:", long_options.data(),
                  &option_index);
         if (option_char == -1) {
             break;
@@ -219,6 +378,27 @@ int main(int argc, char* argv[]) {
         case '0':
             null_first = false;
             break;
+        case 't':
+            share_tails = true;
+            break;
+        case 'j':
+            num_threads = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            break;
+        case 'v':
+            vram_budget = strtoul(optarg, nullptr, 0);
+            break;
+        case 'l':
+            dma_budget = strtoul(optarg, nullptr, 0);
+            break;
+        case 'q':
+            sequences_name = optarg;
+            break;
+        case 'H':
+            h32 = true;
+            break;
+        case 'P':
+            pal = true;
+            break;
         case 'x':
             from_sonic_version = strtol(optarg, nullptr, 0);
             if (from_sonic_version < 1 || from_sonic_version > 4) {
@@ -245,6 +425,9 @@ int main(int argc, char* argv[]) {
             ARG_CASE('k', eConvertDPLC, 2, )
             ARG_CASE('i', eInfo, 1, )
             ARG_CASE('d', eDplc, 1, )
+            ARG_CASE('r', eReorderArt, 6, )
+            ARG_CASE('e', eDeltaDplc, 5, )
+            ARG_CASE('b', eDmaBudget, 1, )
             ARG_CASE(
                     'p', ePalChange, 2,
                     source_palette = (strtoul(optarg, nullptr, 0) & 3U) << 5U)
@@ -294,10 +477,12 @@ int main(int argc, char* argv[]) {
         TEST_FILE(output_maps, optind + 2, eOutputMapsMissing);
         TEST_FILE(output_dplc, optind + 3, eOutputDplcMissing);
 
-        dest_maps.write(output_maps, to_sonic_version, null_first);
+        saved += dest_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
 
-        dest_dplc.write(output_dplc, to_sonic_version, null_first);
+        saved += dest_dplc.write(
+                output_dplc, to_sonic_version, null_first, share_tails);
         output_dplc.close();
         break;
     }
@@ -318,10 +503,12 @@ int main(int argc, char* argv[]) {
         TEST_FILE(output_maps, optind + 1, eOutputMapsMissing);
         TEST_FILE(output_dplc, optind + 2, eOutputDplcMissing);
 
-        dest_maps.write(output_maps, to_sonic_version, null_first);
+        saved += dest_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
 
-        dest_dplc.write(output_dplc, to_sonic_version, null_first);
+        saved += dest_dplc.write(
+                output_dplc, to_sonic_version, null_first, share_tails);
         output_dplc.close();
         break;
     }
@@ -343,7 +530,8 @@ int main(int argc, char* argv[]) {
         ofstream output_maps(argv[optind + 2], ios::out | ios::binary | ios::trunc);
         TEST_FILE(output_maps, optind + 2, eOutputMapsMissing);
 
-        dest_maps.write(output_maps, to_sonic_version, null_first);
+        saved += dest_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
         break;
     }
@@ -357,7 +545,8 @@ int main(int argc, char* argv[]) {
         ofstream output_maps(argv[optind + 1], ios::out | ios::binary | ios::trunc);
         TEST_FILE(output_maps, optind + 1, eOutputMapsMissing);
 
-        source_maps.write(output_maps, to_sonic_version, null_first);
+        saved += source_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
         break;
     }
@@ -371,7 +560,8 @@ int main(int argc, char* argv[]) {
         ofstream output_maps(argv[optind + 1], ios::out | ios::binary | ios::trunc);
         TEST_FILE(output_maps, optind + 1, eOutputMapsMissing);
 
-        source_maps.write(output_maps, to_sonic_version, null_first);
+        saved += source_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
         break;
     }
@@ -385,7 +575,8 @@ int main(int argc, char* argv[]) {
         ofstream output_dplc(argv[optind + 1], ios::out | ios::binary | ios::trunc);
         TEST_FILE(output_dplc, optind + 1, eOutputDplcMissing);
 
-        srcdplc.write(output_dplc, to_sonic_version, null_first);
+        saved += srcdplc.write(
+                output_dplc, to_sonic_version, null_first, share_tails);
         output_dplc.close();
         break;
     }
@@ -422,10 +613,287 @@ int main(int argc, char* argv[]) {
         ofstream output_maps(argv[optind + 1], ios::out | ios::binary | ios::trunc);
         TEST_FILE(output_maps, optind + 1, eOutputMapsMissing);
 
-        source_maps.write(output_maps, to_sonic_version, null_first);
+        saved += source_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
         output_maps.close();
         break;
     }
+    case eReorderArt: {
+        ifstream input_art(argv[optind + 0], ios::in | ios::binary);
+        ifstream input_maps(argv[optind + 1], ios::in | ios::binary);
+        ifstream input_dplc(argv[optind + 2], ios::in | ios::binary);
+        TEST_FILE(input_art, optind + 0, eInputArtMissing);
+        TEST_FILE(input_maps, optind + 1, eInputMapsMissing);
+        TEST_FILE(input_dplc, optind + 2, eInputDplcMissing);
+
+        std::vector<uint8_t> const art{
+                std::istreambuf_iterator<char>(input_art),
+                std::istreambuf_iterator<char>()};
+        input_art.close();
+
+        mapping_file const source_maps(input_maps, from_sonic_version);
+        input_maps.close();
+
+        dplc_file const source_dplc(input_dplc, from_sonic_version);
+        input_dplc.close();
+
+        if (source_dplc.frames.size() < source_maps.frames.size()) {
+            cerr << "DPLC file has fewer frames than the mappings." << endl;
+            return eInvalidArt;
+        }
+        mapping_file art_maps;
+        art_maps.merge(source_maps, source_dplc);
+        size_t const art_size = art.size() / 32;
+        for (auto const& frame : art_maps.frames) {
+            for (auto const& piece : frame.maps) {
+                if (piece.tile + size_t(piece.sx) * size_t(piece.sy)
+                    > art_size) {
+                    cerr << "Mappings use tiles that are not in the art."
+                         << endl;
+                    return eInvalidArt;
+                }
+            }
+        }
+
+        art_order const order(art_maps, art_size, num_threads);
+        order.apply(art_maps);
+        std::vector<uint8_t> const dest_art = order.apply(art);
+
+        mapping_file dest_maps;
+        dplc_file    dest_dplc = dest_maps.split(art_maps);
+
+        ofstream output_art(
+                argv[optind + 3], ios::out | ios::binary | ios::trunc);
+        ofstream output_maps(
+                argv[optind + 4], ios::out | ios::binary | ios::trunc);
+        ofstream output_dplc(
+                argv[optind + 5], ios::out | ios::binary | ios::trunc);
+        TEST_FILE(output_art, optind + 3, eOutputArtMissing);
+        TEST_FILE(output_maps, optind + 4, eOutputMapsMissing);
+        TEST_FILE(output_dplc, optind + 5, eOutputDplcMissing);
+
+        output_art.write(
+                static_cast<char const*>(
+                        static_cast<void const*>(dest_art.data())),
+                static_cast<std::streamsize>(dest_art.size()));
+        output_art.close();
+
+        saved += dest_maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
+        output_maps.close();
+
+        saved += dest_dplc.write(
+                output_dplc, to_sonic_version, null_first, share_tails);
+        output_dplc.close();
+
+        cout << "DPLC entries:   " << order.before.total << " -> "
+             << order.after.total << endl;
+        cout << "Worst frame:    " << order.before.worst << " -> "
+             << order.after.worst << endl;
+        break;
+    }
+    case eDeltaDplc: {
+        ifstream input_maps(argv[optind + 0], ios::in | ios::binary);
+        ifstream input_dplc(argv[optind + 1], ios::in | ios::binary);
+        ifstream input_sequences(argv[optind + 2], ios::in);
+        TEST_FILE(input_maps, optind + 0, eInputMapsMissing);
+        TEST_FILE(input_dplc, optind + 1, eInputDplcMissing);
+        TEST_FILE(input_sequences, optind + 2, eSequencesMissing);
+
+        mapping_file const source_maps(input_maps, from_sonic_version);
+        input_maps.close();
+
+        dplc_file const source_dplc(input_dplc, from_sonic_version);
+        input_dplc.close();
+
+        if (source_dplc.frames.size() < source_maps.frames.size()) {
+            cerr << "DPLC file has fewer frames than the mappings." << endl;
+            return eInvalidSequences;
+        }
+
+        vector<vector<size_t>> sequences;
+        if (!read_sequences(
+                    input_sequences, source_maps.frames.size(), sequences)) {
+            return eInvalidSequences;
+        }
+        input_sequences.close();
+
+        mapping_file art_maps;
+        art_maps.merge(source_maps, source_dplc);
+        delta_dplc const dest(art_maps, sequences, vram_budget);
+        for (auto const& [index, tiles] : dest.over_budget) {
+            cerr << "Sequence " << index << " (";
+            char const* separator = "";
+            for (auto const frame : sequences[index]) {
+                cerr << separator << "0x" << std::hex << std::uppercase
+                     << frame << std::dec;
+                separator = ", ";
+            }
+            cerr << ") has a frame that needs " << tiles
+                 << " tiles of VRAM, more than the budget of " << vram_budget
+                 << " tiles." << endl;
+        }
+        if (!dest.over_budget.empty()) {
+            return eOverVramBudget;
+        }
+
+        ofstream output_maps(
+                argv[optind + 3], ios::out | ios::binary | ios::trunc);
+        ofstream output_dplc(
+                argv[optind + 4], ios::out | ios::binary | ios::trunc);
+        TEST_FILE(output_maps, optind + 3, eOutputMapsMissing);
+        TEST_FILE(output_dplc, optind + 4, eOutputDplcMissing);
+
+        saved += dest.maps.write(
+                output_maps, to_sonic_version, null_first, share_tails);
+        output_maps.close();
+
+        saved += dest.dplc.write(
+                output_dplc, to_sonic_version, null_first, share_tails);
+        output_dplc.close();
+
+        for (auto const& sequence : dest.sequences) {
+            char const* separator = "";
+            for (auto const frame : sequence) {
+                cout << separator << "0x" << std::hex << std::uppercase
+                     << frame << std::dec;
+                separator = ", ";
+            }
+            cout << endl;
+        }
+        cerr << "Tiles loaded:   " << dest.tiles_before << " -> "
+             << dest.tiles_after << endl;
+        cerr << "VRAM tiles:     " << dest.vram_tiles << endl;
+        break;
+    }
+    case eDmaBudget: {
+        dma_timing const timing(h32, pal);
+        if (dma_budget == 0) {
+            dma_budget = timing.vblank_bytes();
+        }
+
+        vector<std::filesystem::path> names;
+        for (int ii = optind; ii < argc; ii++) {
+            std::filesystem::path const name(argv[ii]);
+            if (!std::filesystem::is_directory(name)) {
+                names.push_back(name);
+                continue;
+            }
+            vector<std::filesystem::path> entries;
+            for (auto const& entry :
+                 std::filesystem::directory_iterator(name)) {
+                if (entry.is_regular_file()) {
+                    entries.push_back(entry.path());
+                }
+            }
+            std::sort(entries.begin(), entries.end());
+            names.insert(names.end(), entries.cbegin(), entries.cend());
+        }
+
+        // Frames are checked against each DPLC file once it is read.
+        vector<vector<size_t>> sequences;
+        size_t                 sequence_frames = 0;
+        if (sequences_name != nullptr) {
+            ifstream input_sequences(sequences_name, ios::in);
+            if (!input_sequences.good()) {
+                cerr << "File '" << sequences_name
+                     << "' could not be opened." << endl
+                     << endl;
+                return eSequencesMissing;
+            }
+            if (!read_sequences(
+                        input_sequences, std::numeric_limits<size_t>::max(),
+                        sequences)) {
+                return eInvalidSequences;
+            }
+            input_sequences.close();
+            for (auto const& sequence : sequences) {
+                for (auto const frame : sequence) {
+                    sequence_frames = std::max(sequence_frames, frame + 1);
+                }
+            }
+        }
+
+        // Every file is read and checked before the first row is printed, so
+        // a bad file does not leave partial output behind.
+        vector<dplc_file> dplcs;
+        for (auto const& name : names) {
+            ifstream input_dplc(name, ios::in | ios::binary);
+            if (!input_dplc.good()) {
+                cerr << "File '" << name.string() << "' could not be opened."
+                     << endl
+                     << endl;
+                return eInputDplcMissing;
+            }
+            dplc_file const& source_dplc
+                    = dplcs.emplace_back(input_dplc, from_sonic_version);
+            input_dplc.close();
+            if (sequence_frames > source_dplc.frames.size()) {
+                cerr << "Sequences use frames that are not in '"
+                     << name.string() << "'." << endl;
+                return eInvalidSequences;
+            }
+        }
+
+        size_t frame_count = 0;
+        size_t over_count  = 0;
+        cout << std::fixed << std::setprecision(1);
+        cout << "file,kind,index,tiles,bytes,commands,display_lines,"
+                "vblank_lines,display_us,vblank_us,over_budget"
+             << endl;
+        for (size_t file = 0; file < names.size(); file++) {
+            auto const&      name        = names[file];
+            dplc_file const& source_dplc = dplcs[file];
+
+            // Names are quoted, as they may have commas.
+            string quoted = "\"";
+            for (char const elem : name.string()) {
+                quoted += elem;
+                if (elem == '"') {
+                    quoted += elem;
+                }
+            }
+            quoted += '"';
+
+            vector<size_t> tiles;
+            for (size_t ii = 0; ii < source_dplc.frames.size(); ii++) {
+                auto const& frame = source_dplc.frames[ii].dplc;
+                size_t      count = 0;
+                for (auto const& elem : frame) {
+                    count += elem.count;
+                }
+                tiles.push_back(count);
+                bool const over = count * 32 > dma_budget;
+                print_dma_row(
+                        timing, quoted, "frame", ii, count, frame.size(),
+                        over ? 1 : 0);
+                frame_count++;
+                over_count += over ? 1 : 0;
+            }
+
+            for (size_t ii = 0; ii < sequences.size(); ii++) {
+                size_t total    = 0;
+                size_t commands = 0;
+                size_t over     = 0;
+                auto const& sequence = sequences[ii];
+                for (size_t jj = 0; jj < sequence.size(); jj++) {
+                    size_t const frame = sequence[jj];
+                    if (jj != 0 && frame == sequence[jj - 1]) {
+                        continue;
+                    }
+                    total += tiles[frame];
+                    commands += source_dplc.frames[frame].dplc.size();
+                    over += tiles[frame] * 32 > dma_budget ? 1 : 0;
+                }
+                print_dma_row(
+                        timing, quoted, "sequence", ii, total, commands,
+                        over);
+            }
+        }
+        cerr << "Frames over budget: " << over_count << " of " << frame_count
+             << " (budget " << dma_budget << " bytes)." << endl;
+        break;
+    }
     case eNone:
         cerr << "Divide By Cucumber Error. Please Reinstall Universe And "
                 "Reboot."
@@ -433,5 +901,8 @@ int main(int argc, char* argv[]) {
         __builtin_unreachable();
     }
 
+    if (share_tails) {
+        cerr << "Shared tails saved " << saved << " bytes." << endl;
+    }
     return 0;
 }
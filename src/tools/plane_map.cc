@@ -19,7 +19,9 @@
 #include <mdcomp/bigendian_io.hh>
 #include <mdcomp/enigma.hh>
 #include <mdtools/ignore_unused_variable_warning.hh>
+#include <mdtools/plane.hh>
 
+#include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
@@ -87,13 +89,14 @@ static void plane_map(
     }
 
     for (size_t frame = 0; frame < nframes; frame++, offset += 2) {
+        Plane const plane(width, height, source, false);
         BigEndian::Write2(dest, width * height);
         for (size_t line = 0; line < height; line++) {
             auto y_pos = static_cast<int8_t>((line - height / 2) << 3U);
             for (size_t column = 0; column < width; column++) {
                 dest.put(static_cast<char>(y_pos));
                 dest.put(static_cast<char>(0x00));
-                uint16_t value = BigEndian::Read2(source);
+                uint16_t value = plane[line][column].get_value();
                 BigEndian::Write2(dest, value);
                 if (sonic2) {
                     BigEndian::Write2(
@@ -18,52 +18,405 @@
 #include <getopt.h>
 #include <mdcomp/enigma.hh>
 #include <mdcomp/kosinski.hh>
+#include <mdtools/mapped_file.hh>
+#include <mdtools/parallel_for.hh>
+#include <mdtools/span_stream.hh>
 #include <mdtools/sstrack.hh>
 #include <mdtools/ssvram.hh>
 
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <span>
+#include <string>
+#include <vector>
 
 using std::cerr;
+using std::cout;
 using std::endl;
 using std::ifstream;
 using std::ios;
 using std::istream;
 using std::ofstream;
 using std::ostream;
-using std::stringstream;
+using std::string;
+using std::vector;
 
 static void usage(char* prog) {
     cerr << "Usage: " << prog
-         << " [-f|--flipped] {inpal} {inart} {input_track} {output_art_kos} "
-            "{output_plane_kos} {output_plane_eni}"
+         << " [-f|--flipped] [-t|--tables=FILE] {inpal} {inart} {input_track} "
+            "{output_art_kos} {output_plane_kos} {output_plane_eni}"
+         << endl;
+    cerr << "       " << prog
+         << " -b|--batch [-f|--flipped] [-t|--tables=FILE] {inpal} {inart} "
+            "{output_art_kos} {output_plane_prefix} {input_track}..."
+         << endl;
+    cerr << "       " << prog
+         << " --benchmark=ROUNDS [-f|--flipped] [-t|--tables=FILE] "
+            "{input_track}..."
          << endl;
     cerr << endl;
     cerr << "\t-f,--flipped\tFlips the give frame horizontally." << endl;
+    cerr << "\t-b,--batch  \tExpands all the given frames of a stage with "
+            "one shared art file. The plane maps"
+         << endl
+         << "\t            \tof each frame are written to "
+            "{output_plane_prefix}{name}.kos and .eni, where {name} is"
+         << endl
+         << "\t            \tthe name of the track file without its "
+            "extension."
+         << endl;
+    cerr << "\t-t,--tables \tDecodes the track frames with the lookup tables "
+            "in FILE instead of those of the"
+         << endl
+         << "\t            \tgame. FILE has the four tables back to back, in "
+            "the order the game has them."
+         << endl;
+    cerr << "\t--benchmark \tDecodes the given frames ROUNDS times with each "
+            "track frame decoder, checks that"
+         << endl
+         << "\t            \tthey agree, and reports how fast each one is."
+         << endl;
+}
+
+// Builds the tiles of a scene equivalent to the track frame, in the order of
+// the plane map.
+static vector<Tile> expand_frame(
+        SSVRAM const& ssvram, SSTrackFrame const& track) {
+    vector<Tile> merged;
+    merged.reserve(PlaneH32V28::Width * PlaneH32V28::Height);
+    for (unsigned cur_line = 0; cur_line < SSTrackFrame::Height; cur_line++) {
+        auto const& tline = track[cur_line];
+        const auto* line0 = tline.cbegin();
+        const auto* line1 = line0 + PlaneH32V28::Width;
+        const auto* line2 = line1 + PlaneH32V28::Width;
+        const auto* line3 = line2 + PlaneH32V28::Width;
+        const auto* tlast = tline.cend();
+        while (line3 != tlast) {
+            Pattern_Name    pat0  = *line0++;
+            Pattern_Name    pat1  = *line1++;
+            Pattern_Name    pat2  = *line2++;
+            Pattern_Name    pat3  = *line3++;
+            ShortTile const tile0 = ssvram[pat0];
+            ShortTile const tile1 = ssvram[pat1];
+            ShortTile const tile2 = ssvram[pat2];
+            ShortTile const tile3 = ssvram[pat3];
+            merged.push_back(merge_tiles(
+                    tile0, pat0.get_flip(), tile1, pat1.get_flip(), tile2,
+                    pat2.get_flip(), tile3, pat3.get_flip()));
+        }
+    }
+    return merged;
+}
+
+// Fills the plane map from the matches for the tiles of a frame.
+static void fill_plane(
+        PlaneH32V28& plane, std::span<VRAM<Tile>::Match const> matches) {
+    auto match = matches.begin();
+    for (unsigned cur_line = 0; cur_line < SSTrackFrame::Height; cur_line++) {
+        for (auto& pattern : plane[cur_line]) {
+            pattern = (match++)->pattern;
+        }
+    }
+}
+
+static bool encode_kosinski(istream& input, ostream& output) {
+    return kosinski::encode(input, output);
+}
+
+static bool encode_enigma(istream& input, ostream& output) {
+    return enigma::encode(input, output);
+}
+
+// A compression to run: the data, which is read in place, how to compress it
+// and where to write the result.
+struct Compression {
+    std::span<uint8_t const> data;
+    bool (*encode)(istream&, ostream&);
+    ostream* output;
+};
+
+// Runs the compressions at the same time, each of them writing to its output as
+// soon as it is done. They are started in order, so the largest should come
+// first.
+static void run_compressions(std::span<Compression const> compressions) {
+    parallel_for(compressions.size(), 0, [&](size_t const ii) {
+        Compression const& compression = compressions[ii];
+        SpanInputStream    input(compression.data);
+        compression.encode(input, *compression.output);
+    });
+}
+
+// Expands all frames of a stage into one art file and a plane map per frame.
+// The frames are decoded in parallel, and their tiles are then added to VRAM
+// in order, so that the result does not depend on the number of threads.
+static int expand_stage(
+        int argc, char* argv[], bool const flipped,
+        SSTrackTables const& tables) {
+    enum ArgumentIDs {
+        InPal = 0,
+        InArt,
+        OutArtKos,
+        OutPlanePrefix,
+        FirstTrack
+    };
+    if (argc <= FirstTrack) {
+        return -1;
+    }
+
+    ifstream inpal(argv[InPal], ios::in | ios::binary);
+    if (!inpal.good()) {
+        cerr << "Could not read from palette file '" << argv[InPal] << "'."
+             << endl;
+        return InPal + 2;
+    }
+
+    ifstream input_art(argv[InArt], ios::in | ios::binary);
+    if (!input_art.good()) {
+        cerr << "Could not read from art file '" << argv[InArt] << "'."
+             << endl;
+        return InArt + 2;
+    }
+
+    SSVRAM const ssvram(inpal, input_art);
+
+    std::span<char*> const tracks(argv + FirstTrack, argv + argc);
+    // The plane maps are named after the tracks, so the names must differ.
+    vector<string> stems;
+    stems.reserve(tracks.size());
+    for (size_t ii = 0; ii < tracks.size(); ii++) {
+        stems.push_back(std::filesystem::path(tracks[ii]).stem().string());
+        for (size_t jj = 0; jj < ii; jj++) {
+            if (stems[jj] == stems[ii]) {
+                cerr << "Track files '" << tracks[jj] << "' and '"
+                     << tracks[ii] << "' would both write plane maps named '"
+                     << argv[OutPlanePrefix] << stems[ii] << "'." << endl;
+                return OutPlanePrefix + 2;
+            }
+        }
+    }
+
+    vector<vector<Tile>>   frames(tracks.size());
+    vector<uint8_t>        found(tracks.size(), 0);
+    vector<uint8_t>        decoded(tracks.size(), 0);
+    parallel_for(tracks.size(), 0, [&](size_t const ii) {
+        MappedFile const input_track(tracks[ii]);
+        if (!input_track.good()) {
+            return;
+        }
+        found[ii] = 1;
+        SSTrackFrame const track(
+                input_track.bytes(), flipped, TrackDecoder::Table, tables);
+        if (!track.good()) {
+            return;
+        }
+        decoded[ii] = 1;
+        frames[ii]  = expand_frame(ssvram, track);
+    });
+    for (size_t ii = 0; ii < tracks.size(); ii++) {
+        if (found[ii] == 0) {
+            cerr << "Could not read from track file '" << tracks[ii] << "'."
+                 << endl;
+            return FirstTrack + 2;
+        }
+        if (decoded[ii] == 0) {
+            cerr << "Track file '" << tracks[ii] << "' is malformed." << endl;
+            return FirstTrack + 2;
+        }
+    }
+
+    // Now the plane maps and art, adding any tile that is not already in VRAM.
+    vector<Tile> merged;
+    merged.reserve(tracks.size() * PlaneH32V28::Width * PlaneH32V28::Height);
+    for (auto const& frame : frames) {
+        merged.insert(merged.end(), frame.cbegin(), frame.cend());
+    }
+    VRAM<Tile> vram;
+    vram.copy_dist_table(ssvram);
+    auto const matches = vram.find_or_add(merged);
+    // Pattern names cannot reach any further.
+    if (vram.size() > 0x800) {
+        cerr << "The frames need " << vram.size()
+             << " tiles, more than fit in VRAM." << endl;
+        return FirstTrack + 3;
+    }
+
+    ofstream art_output(argv[OutArtKos], ios::out | ios::binary | ios::trunc);
+    if (!art_output.good()) {
+        cerr << "Could not open output art file '" << argv[OutArtKos] << "'."
+             << endl;
+        return OutArtKos + 2;
+    }
+
+    // The art, then the plane map of each frame as Kosinski and as Enigma.
+    auto const per_frame
+            = static_cast<size_t>(PlaneH32V28::Width * PlaneH32V28::Height);
+
+    vector<uint8_t> const   art = vram.pack();
+    vector<vector<uint8_t>> planes(tracks.size());
+    vector<ofstream>        plane_outputs;
+    vector<Compression>     compressions{{art, encode_kosinski, &art_output}};
+    plane_outputs.reserve(tracks.size() * 2);
+    for (size_t ii = 0; ii < tracks.size(); ii++) {
+        PlaneH32V28 plane;
+        fill_plane(
+                plane,
+                std::span(matches).subspan(ii * per_frame, per_frame));
+        planes[ii] = plane.pack();
+
+        string const prefix = string(argv[OutPlanePrefix]) + stems[ii];
+        auto& plane_kos = plane_outputs.emplace_back(
+                prefix + ".kos", ios::out | ios::binary | ios::trunc);
+        auto& plane_eni = plane_outputs.emplace_back(
+                prefix + ".eni", ios::out | ios::binary | ios::trunc);
+        if (!plane_kos.good() || !plane_eni.good()) {
+            cerr << "Could not open output plane map files '" << prefix
+                 << ".kos' and '" << prefix << ".eni'." << endl;
+            return OutPlanePrefix + 2;
+        }
+        compressions.push_back({planes[ii], encode_kosinski, &plane_kos});
+        compressions.push_back({planes[ii], encode_enigma, &plane_eni});
+    }
+    run_compressions(compressions);
+    return 0;
+}
+
+// Decodes the track frames with both decoders, checks that they give the same
+// results, and then times each decoder over the given number of rounds.
+static int benchmark_decoders(
+        int argc, char* argv[], bool const flipped, SSTrackTables const& tables,
+        unsigned const rounds) {
+    if (argc < 1) {
+        return -1;
+    }
+    vector<MappedFile> tracks;
+    tracks.reserve(static_cast<size_t>(argc));
+    size_t total_size = 0;
+    for (int ii = 0; ii < argc; ii++) {
+        tracks.emplace_back(argv[ii]);
+        if (!tracks.back().good()) {
+            cerr << "Could not read from track file '" << argv[ii] << "'."
+                 << endl;
+            return 2;
+        }
+        total_size += tracks.back().bytes().size();
+    }
+
+    for (size_t ii = 0; ii < tracks.size(); ii++) {
+        SSTrackFrame const bitwise(
+                tracks[ii].bytes(), flipped, TrackDecoder::Bitwise, tables);
+        SSTrackFrame const table(
+                tracks[ii].bytes(), flipped, TrackDecoder::Table, tables);
+        if (bitwise.good() != table.good()
+            || (bitwise.good() && bitwise.pack() != table.pack())) {
+            cerr << "The decoders disagree on track file '" << argv[ii] << "'."
+                 << endl;
+            return 3;
+        }
+    }
+
+    struct Decoder {
+        char const*  name;
+        TrackDecoder decoder;
+    };
+    constexpr static std::array const decoders{
+            Decoder{"Bitwise", TrackDecoder::Bitwise},
+            Decoder{"Table", TrackDecoder::Table}};
+    double const frames = double(tracks.size()) * rounds;
+    double const bytes  = double(total_size) * rounds;
+    for (auto const& [name, decoder] : decoders) {
+        // Keeps the decoding from being optimized away.
+        unsigned   checksum = 0;
+        auto const start    = std::chrono::steady_clock::now();
+        for (unsigned round = 0; round < rounds; round++) {
+            for (auto const& track_file : tracks) {
+                SSTrackFrame const track(
+                        track_file.bytes(), flipped, decoder, tables);
+                checksum += track[0][0].get_tile();
+            }
+        }
+        std::chrono::duration<double> const elapsed
+                = std::chrono::steady_clock::now() - start;
+        cout << std::left << std::setw(8) << name << std::right << std::fixed
+             << std::setprecision(3) << std::setw(10)
+             << elapsed.count() * 1e6 / frames << " us/frame"
+             << std::setw(10) << bytes / elapsed.count() / (1 << 20)
+             << " MiB/s (checksum " << checksum << ")" << endl;
+    }
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
     constexpr static const std::array long_options{
             option{"flipped", no_argument, nullptr, 'f'},
+            option{"batch", no_argument, nullptr, 'b'},
+            option{"tables", required_argument, nullptr, 't'},
+            option{"benchmark", required_argument, nullptr, 'B'},
             option{nullptr, 0, nullptr, 0}};
 
-    bool flipped = false;
+    bool     flipped     = false;
+    bool     batch       = false;
+    unsigned rounds      = 0;
+    char*    tables_name = nullptr;
 
     while (true) {
         int option_index = 0;
         int option_char  = getopt_long(
-                 argc, argv, "f", long_options.data(), &option_index);
+                 argc, argv, "fbt:", long_options.data(), &option_index);
         if (option_char == -1) {
             break;
         }
 
         if (option_char == 'f') {
             flipped = true;
+        } else if (option_char == 'b') {
+            batch = true;
+        } else if (option_char == 't') {
+            tables_name = optarg;
+        } else if (option_char == 'B') {
+            rounds = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            if (rounds == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    SSTrackTables tables = SSTrackTables::standard();
+    if (tables_name != nullptr) {
+        MappedFile const tables_file(tables_name);
+        if (!tables_file.good() || !tables.load(tables_file.bytes())) {
+            cerr << "Could not read track lookup tables from file '"
+                 << tables_name << "'." << endl;
+            return 1;
         }
     }
 
+    if (rounds != 0) {
+        int const result = benchmark_decoders(
+                argc - optind, argv + optind, flipped, tables, rounds);
+        if (result < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return result;
+    }
+
+    if (batch) {
+        int const result
+                = expand_stage(argc - optind, argv + optind, flipped, tables);
+        if (result < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return result;
+    }
+
     enum ArgumentIDs {
         InPal = 0,
         InArt,
@@ -98,6 +451,15 @@ int main(int argc, char* argv[]) {
              << "'." << endl;
         return InTrack + 2;
     }
+    // Decoded before opening the outputs, so that they are left alone if the
+    // track is malformed.
+    SSTrackFrame const track(
+            input_track, flipped, TrackDecoder::Table, tables);
+    if (!track.good()) {
+        cerr << "Track file '" << argv[optind + InTrack] << "' is malformed."
+             << endl;
+        return InTrack + 2;
+    }
 
     ofstream art_output(
             argv[optind + OutArtKos], ios::out | ios::binary | ios::trunc);
@@ -123,60 +485,26 @@ int main(int argc, char* argv[]) {
         return OutPlaneEni + 2;
     }
 
-    SSVRAM       ssvram(inpal, input_art);
-    SSTrackFrame track(input_track, flipped);
+    SSVRAM ssvram(inpal, input_art);
 
     // Lets draw it!
     VRAM<Tile> vram;
     vram.copy_dist_table(ssvram);
     PlaneH32V28 plane;
 
-    // First, lets create plane map and art for an equivalent scene.
-    for (unsigned cur_line = 0; cur_line < SSTrackFrame::Height; cur_line++) {
-        auto&       tline = track[cur_line];
-        auto&       pline = plane[cur_line];
-        const auto* line0 = tline.cbegin();
-        const auto* line1 = line0 + PlaneH32V28::Width;
-        const auto* line2 = line1 + PlaneH32V28::Width;
-        const auto* line3 = line2 + PlaneH32V28::Width;
-        const auto* tlast = tline.cend();
-        auto*       dest  = pline.begin();
-        while (line3 != tlast) {
-            Pattern_Name pat0   = *line0++;
-            Pattern_Name pat1   = *line1++;
-            Pattern_Name pat2   = *line2++;
-            Pattern_Name pat3   = *line3++;
-            ShortTile&   tile0  = ssvram[pat0];
-            ShortTile&   tile1  = ssvram[pat1];
-            ShortTile&   tile2  = ssvram[pat2];
-            ShortTile&   tile3  = ssvram[pat3];
-            Tile         merged = merge_tiles(
-                            tile0, pat0.get_flip(), tile1, pat1.get_flip(), tile2,
-                            pat2.get_flip(), tile3, pat3.get_flip());
-            Pattern_Name best_pattern;
-            unsigned     dist = vram.find_closest(merged, best_pattern);
-            if (dist != 0) {
-                best_pattern = vram.push_back(merged);
-            }
-            *dest++ = best_pattern;
-        }
-    }
-
-    // Now, lets save the plane map and art. First, the art.
-    stringstream art_buffer(ios::in | ios::out | ios::binary);
-    vram.write(art_buffer);
-    art_buffer.seekg(0);
-    kosinski::encode(art_buffer, art_output);
+    // First, lets build the tiles of an equivalent scene. Then the plane map
+    // and art, adding any tile that is not already in VRAM.
+    auto const matches = vram.find_or_add(expand_frame(ssvram, track));
+    fill_plane(plane, matches);
 
-    // Now plane map.
-    stringstream plane_buffer(ios::in | ios::out | ios::binary);
-    plane.write(plane_buffer);
-    plane_buffer.seekg(0);
-    // First as Kosinski.
-    kosinski::encode(plane_buffer, plane_kos);
-    plane_buffer.seekg(0);
-    // Now as Enigma.
-    enigma::encode(plane_buffer, plane_eni);
+    // Now, lets save the plane map and art.
+    vector<uint8_t> const            art         = vram.pack();
+    vector<uint8_t> const            plane_bytes = plane.pack();
+    std::array<Compression, 3> const compressions{
+            Compression{art, encode_kosinski, &art_output},
+            Compression{plane_bytes, encode_kosinski, &plane_kos},
+            Compression{plane_bytes, encode_enigma, &plane_eni}};
+    run_compressions(compressions);
 
     return 0;
 }
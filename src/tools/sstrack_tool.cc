@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) Flamewing 2021 <flamewing.sonic@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <mdtools/mapped_file.hh>
+#include <mdtools/sstrack.hh>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::ios;
+using std::ofstream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+static void usage(char* prog) {
+    cerr << "Usage: " << prog
+         << " -x|--extract [-f|--flipped] [-t|--tables=FILE] {input_track} "
+            "{output_plane}"
+         << endl;
+    cerr << "       " << prog
+         << " [-f|--flipped] [-t|--tables=FILE] {input_plane} {output_track}"
+         << endl;
+    cerr << "       " << prog
+         << " -c|--check [-f|--flipped] [-t|--tables=FILE] {input_track}..."
+         << endl;
+    cerr << "       " << prog
+         << " -s|--stats [-n|--worst=N] [-f|--flipped] [-t|--tables=FILE] "
+            "{input_track}..."
+         << endl;
+    cerr << endl;
+    cerr << "\tEncodes an uncompressed 128x28 plane map into a special stage "
+            "track frame, as small as the"
+         << endl
+         << "\tlookup tables allow." << endl;
+    cerr << "\t-x,--extract\tDecodes a track frame into an uncompressed plane "
+            "map instead."
+         << endl;
+    cerr << "\t-c,--check  \tDecodes each track frame, encodes it again and "
+            "checks that it decodes to"
+         << endl
+         << "\t            \tthe same plane map; reports the old and new "
+            "sizes."
+         << endl;
+    cerr << "\t-s,--stats  \tEstimates how many 68000 cycles the game takes "
+            "to decode each track frame,"
+         << endl
+         << "\t            \tand reports the most expensive frames with "
+            "their most expensive lines."
+         << endl;
+    cerr << "\t-n,--worst  \tHow many frames to report; all of them if 0. "
+            "The default is 10."
+         << endl;
+    cerr << "\t-f,--flipped\tThe plane map is the frame flipped horizontally."
+         << endl;
+    cerr << "\t-t,--tables \tUses the lookup tables in FILE instead of those "
+            "of the game. FILE has the"
+         << endl
+         << "\t            \tfour tables back to back, in the order the game "
+            "has them."
+         << endl;
+}
+
+// Encodes each track frame again, and checks that it decodes as before.
+static int check_frames(
+        int argc, char* argv[], bool const flipped,
+        SSTrackTables const& tables) {
+    if (argc < 1) {
+        return -1;
+    }
+    SSTrackEncoder const encoder(tables);
+    size_t               old_total = 0;
+    size_t               new_total = 0;
+    for (int ii = 0; ii < argc; ii++) {
+        MappedFile const input_track(argv[ii]);
+        if (!input_track.good()) {
+            cerr << "Could not read from track file '" << argv[ii] << "'."
+                 << endl;
+            return 2;
+        }
+        SSTrackFrame const track(
+                input_track.bytes(), flipped, TrackDecoder::Table, tables);
+        if (!track.good()) {
+            cerr << "Track file '" << argv[ii] << "' is malformed." << endl;
+            return 2;
+        }
+        stringstream encoded(ios::in | ios::out | ios::binary);
+        if (!encoder.encode(track, encoded, flipped)) {
+            cerr << "Track file '" << argv[ii] << "' could not be encoded."
+                 << endl;
+            return 3;
+        }
+        string const                  data = encoded.str();
+        std::span<uint8_t const> const bytes(
+                static_cast<uint8_t const*>(static_cast<void const*>(
+                        data.data())),
+                data.size());
+        SSTrackFrame const bitwise(
+                bytes, flipped, TrackDecoder::Bitwise, tables);
+        SSTrackFrame const table(bytes, flipped, TrackDecoder::Table, tables);
+
+        vector<uint8_t> const expected = track.pack();
+        if (!bitwise.good() || !table.good() || bitwise.pack() != expected
+            || table.pack() != expected) {
+            cerr << "Track file '" << argv[ii]
+                 << "' does not decode to the same plane map once encoded."
+                 << endl;
+            return 4;
+        }
+        cout << argv[ii] << ": " << input_track.bytes().size() << " -> "
+             << data.size() << " bytes" << endl;
+        old_total += input_track.bytes().size();
+        new_total += data.size();
+    }
+    cout << "Total: " << old_total << " -> " << new_total << " bytes" << endl;
+    return 0;
+}
+
+// Estimates the decoding cost of each track frame of a stage, and reports the
+// most expensive ones.
+static int report_costs(
+        int argc, char* argv[], bool const flipped,
+        SSTrackTables const& tables, size_t const worst) {
+    if (argc < 1) {
+        return -1;
+    }
+    struct FrameCost {
+        char*        name;
+        size_t       size;
+        SSTrackStats stats;
+        uint32_t     cycles;
+    };
+    vector<FrameCost> frames;
+    frames.reserve(static_cast<size_t>(argc));
+    for (int ii = 0; ii < argc; ii++) {
+        MappedFile const input_track(argv[ii]);
+        if (!input_track.good()) {
+            cerr << "Could not read from track file '" << argv[ii] << "'."
+                 << endl;
+            return 2;
+        }
+        SSTrackStats       stats;
+        SSTrackFrame const track(input_track.bytes(), flipped, stats, tables);
+        if (!track.good()) {
+            cerr << "Track file '" << argv[ii] << "' is malformed." << endl;
+            return 2;
+        }
+        frames.push_back(
+                {argv[ii], input_track.bytes().size(), stats, stats.cycles()});
+    }
+    std::stable_sort(
+            frames.begin(), frames.end(),
+            [](FrameCost const& left, FrameCost const& right) {
+                return left.cycles > right.cycles;
+            });
+
+    uint64_t total = 0;
+    for (auto const& frame : frames) {
+        total += frame.cycles;
+    }
+    cout << "Frames: " << frames.size() << ", average "
+         << total / frames.size() << " cycles, most expensive "
+         << frames.front().cycles << " cycles" << endl;
+    size_t const count
+            = worst == 0 ? frames.size() : std::min(worst, frames.size());
+    for (auto const& frame : std::span(frames).first(count)) {
+        size_t const            index = frame.stats.worst_line();
+        SSTrackLineStats const& line  = frame.stats.lines[index];
+        cout << frame.name << ": " << frame.cycles << " cycles, "
+             << frame.size << " bytes; worst line " << index << ": "
+             << line.cycles() << " cycles, " << line.bits() << " bits, "
+             << line.sym_6bit + line.sym_10bit << " symbolwise and "
+             << line.dic_6bit + line.dic_7bit << " dictionary entries, "
+             << line.run_entries << " entries in runs" << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    constexpr static const std::array long_options{
+            option{"extract", no_argument, nullptr, 'x'},
+            option{"check", no_argument, nullptr, 'c'},
+            option{"stats", no_argument, nullptr, 's'},
+            option{"worst", required_argument, nullptr, 'n'},
+            option{"flipped", no_argument, nullptr, 'f'},
+            option{"tables", required_argument, nullptr, 't'},
+            option{nullptr, 0, nullptr, 0}};
+
+    bool   extract     = false;
+    bool   check       = false;
+    bool   stats       = false;
+    bool   flipped     = false;
+    size_t worst       = 10;
+    char*  tables_name = nullptr;
+
+    while (true) {
+        int option_index = 0;
+        int option_char  = getopt_long(
+                 argc, argv, "xcsn:ft:", long_options.data(), &option_index);
+        if (option_char == -1) {
+            break;
+        }
+
+        switch (option_char) {
+        case 'x':
+            extract = true;
+            break;
+        case 'c':
+            check = true;
+            break;
+        case 's':
+            stats = true;
+            break;
+        case 'n':
+            worst = strtoul(optarg, nullptr, 0);
+            break;
+        case 'f':
+            flipped = true;
+            break;
+        case 't':
+            tables_name = optarg;
+            break;
+        default:
+            break;
+        }
+    }
+
+    SSTrackTables tables = SSTrackTables::standard();
+    if (tables_name != nullptr) {
+        MappedFile const tables_file(tables_name);
+        if (!tables_file.good() || !tables.load(tables_file.bytes())) {
+            cerr << "Could not read track lookup tables from file '"
+                 << tables_name << "'." << endl;
+            return 1;
+        }
+    }
+
+    if (stats) {
+        int const result = report_costs(
+                argc - optind, argv + optind, flipped, tables, worst);
+        if (result < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return result;
+    }
+
+    if (check) {
+        int const result
+                = check_frames(argc - optind, argv + optind, flipped, tables);
+        if (result < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return result;
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ifstream input(argv[optind], ios::in | ios::binary);
+    if (!input.good()) {
+        cerr << "Could not read from input file '" << argv[optind] << "'."
+             << endl;
+        return 2;
+    }
+
+    stringstream buffer(ios::in | ios::out | ios::binary);
+    if (extract) {
+        SSTrackFrame const track(
+                input, flipped, TrackDecoder::Table, tables);
+        if (!track.good()) {
+            cerr << "Track file '" << argv[optind] << "' is malformed."
+                 << endl;
+            return 3;
+        }
+        track.write(buffer);
+    } else {
+        PlaneH128V28 const plane(input, false);
+        if (!SSTrackFrame::encode(plane, buffer, flipped, tables)) {
+            cerr << "Plane map '" << argv[optind]
+                 << "' cannot be encoded with the lookup tables." << endl;
+            return 3;
+        }
+    }
+
+    ofstream output(argv[optind + 1], ios::out | ios::binary | ios::trunc);
+    if (!output.good()) {
+        cerr << "Could not open output file '" << argv[optind + 1] << "'."
+             << endl;
+        return 4;
+    }
+    output << buffer.rdbuf();
+    return 0;
+}